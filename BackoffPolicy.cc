@@ -0,0 +1,73 @@
+/*!
+	\file BackoffPolicy.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the back-off policies used by SpeckMAC-D.
+*/
+
+#include <cstring>
+#include <omnetpp.h>
+#include "BackoffPolicy.h"
+
+/*!
+	\brief Create the back-off policy called \b name ("fixed", "exponential" or "adaptive").
+
+	\param baseDelay
+	The delay of the fixed policy, and the unit of the back-off windows of the others.
+	\param maxExponent
+	The largest exponent of the back-off window of the exponential and adaptive policies, from 0 to 30: the window, 2^maxExponent, is computed as an int.
+	\return The policy; the caller owns it.
+*/
+BackoffPolicy *BackoffPolicy::create(const char *name, double baseDelay, int maxExponent)
+{
+	if ( (maxExponent < 0) || (maxExponent >= 31) )
+		opp_error("\n[Mac]:\n backoffMaxExponent must be between 0 and 30 (got %d).", maxExponent);
+
+	if (strcmp(name, "fixed") == 0)
+		return new FixedBackoff(baseDelay);
+	if (strcmp(name, "exponential") == 0)
+		return new ExponentialBackoff(baseDelay, maxExponent);
+	if (strcmp(name, "adaptive") == 0)
+		return new AdaptiveBackoff(baseDelay, maxExponent);
+
+	opp_error("\n[Mac]:\n Unknown back-off policy \"%s\" (expected fixed, exponential or adaptive).", name);
+	return NULL;
+}
+
+double FixedBackoff::backoff(double random)
+{
+	return baseDelay;
+}
+
+double ExponentialBackoff::backoff(double random)
+{
+	if (attempts < maxExponent)
+		attempts++;
+
+	return baseDelay * (1.0 + random * ((1 << attempts) - 1));
+}
+
+/*!
+	\brief Reset the back-off window once the frame has been sent.
+*/
+void ExponentialBackoff::transmitted()
+{
+	attempts = 0;
+}
+
+const double AdaptiveBackoff::weight = 0.125;
+
+AdaptiveBackoff::AdaptiveBackoff(double theBaseDelay, int maxExponent) : BackoffPolicy(theBaseDelay)
+{
+	maxWindow = (double) ((1 << maxExponent) - 1);
+	busyRatio = 0.0;
+}
+
+double AdaptiveBackoff::backoff(double random)
+{
+	return baseDelay * (1.0 + random * busyRatio * maxWindow);
+}
+
+void AdaptiveBackoff::carrierSensed(bool busy)
+{
+	busyRatio += weight * ((busy ? 1.0 : 0.0) - busyRatio);
+}
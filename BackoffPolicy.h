@@ -0,0 +1,90 @@
+/*!
+	\file BackoffPolicy.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definitions for the back-off policies used by SpeckMAC-D when the carrier is busy before a transmission.
+*/
+
+#ifndef BACKOFFPOLICY
+#define BACKOFFPOLICY
+
+/*!
+ \class BackoffPolicy
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Decides how long a node that found the carrier busy before a transmission waits for a frame, before it goes back to duty cycling and retries.
+
+ The policy is told the outcome of every carrier sense, and when a frame has been sent. It does not draw random numbers itself; the MAC module passes it a uniform random number in [0, 1) with each request, so that the module's random number streams are used.
+*/
+class BackoffPolicy
+{
+	protected:
+		double baseDelay; //!< The delay of the fixed policy: the time to transmit two maximum sized MAC frames.
+
+	public:
+		BackoffPolicy(double theBaseDelay) : baseDelay(theBaseDelay) {}
+		virtual ~BackoffPolicy() {}
+
+		/*!
+			\brief Get the back-off delay after a busy carrier sense before a transmission.
+			\param random A uniform random number in [0, 1).
+		*/
+		virtual double backoff(double random) = 0;
+
+		/*!
+			\brief Observe the outcome of a carrier sense, whether or not the node is transmitting.
+		*/
+		virtual void carrierSensed(bool busy) {}
+
+		/*!
+			\brief Observe that the carrier was free, and the frame has been sent.
+		*/
+		virtual void transmitted() {}
+
+		static BackoffPolicy *create(const char *name, double baseDelay, int maxExponent);
+};
+
+/*!
+ \class FixedBackoff
+ \brief Always waits baseDelay. This is the original SpeckMAC-D behaviour.
+*/
+class FixedBackoff : public BackoffPolicy
+{
+	public:
+		FixedBackoff(double theBaseDelay) : BackoffPolicy(theBaseDelay) {}
+		virtual double backoff(double random);
+};
+
+/*!
+ \class ExponentialBackoff
+ \brief Binary exponential back-off: after the \b k th consecutive busy carrier sense, waits for a random time in [1, 2^k) x baseDelay, with \b k at most maxExponent.
+*/
+class ExponentialBackoff : public BackoffPolicy
+{
+	private:
+		int maxExponent; //!< The largest exponent of the back-off window.
+		int attempts; //!< The number of consecutive busy carrier senses before the current transmission.
+
+	public:
+		ExponentialBackoff(double theBaseDelay, int theMaxExponent) : BackoffPolicy(theBaseDelay), maxExponent(theMaxExponent), attempts(0) {}
+		virtual double backoff(double random);
+		virtual void transmitted();
+};
+
+/*!
+ \class AdaptiveBackoff
+ \brief Load-adaptive back-off: waits for a random time in [1, 1 + busyRatio x (2^maxExponent - 1)) x baseDelay, where busyRatio is a moving average of the outcomes of recent carrier senses.
+*/
+class AdaptiveBackoff : public BackoffPolicy
+{
+	private:
+		double maxWindow; //!< The largest back-off window, in units of baseDelay, less one.
+		double busyRatio; //!< Exponentially weighted moving average of the carrier sense outcomes (1 = busy).
+
+	public:
+		static const double weight; //!< Weight of the latest carrier sense in busyRatio.
+
+		AdaptiveBackoff(double theBaseDelay, int maxExponent);
+		virtual double backoff(double random);
+		virtual void carrierSensed(bool busy);
+};
+
+#endif
@@ -0,0 +1,206 @@
+/*!
+	\file BinaryTrace.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the writer of the binary trace of SpeckMAC-D state transitions.
+	Memory-mapped files use the POSIX mmap() interface.
+*/
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <omnetpp.h>
+#include "BinaryTrace.h"
+
+BinaryTraceWriter *BinaryTraceWriter::shared = NULL;
+
+/*!
+	\brief Obtain the writer shared by all the modules, opening it on the first call. Every call must be matched by a call to release().
+
+	\param baseName
+	The name of the files, without the partition and rotation indices; all the modules of a simulation must give the same name.
+	\param maxFileSize
+	The largest size of a file, in MB; once a file is full, the next one is opened. 0 if files are not rotated.
+	\param mapped
+	Indicate whether the files are memory-mapped, instead of written through a buffer.
+*/
+BinaryTraceWriter *BinaryTraceWriter::acquire(const char *baseName, double maxFileSize, bool mapped)
+{
+	if (shared == NULL)
+		shared = new BinaryTraceWriter(baseName, maxFileSize, mapped);
+	else if (shared->baseName != baseName)
+		opp_error("\n[Mac]:\n All the nodes must write the same binary trace (\"%s\" is already open, \"%s\" requested).", shared->baseName.c_str(), baseName);
+
+	shared->users++;
+	return shared;
+}
+
+/*!
+	\brief Release the writer obtained with acquire(). The last release writes out the records and closes the file.
+*/
+void BinaryTraceWriter::release()
+{
+	if (--users > 0)
+		return;
+
+	shared = NULL;
+	delete this;
+}
+
+BinaryTraceWriter::BinaryTraceWriter(const char *theBaseName, double maxFileSize, bool theMapped) : baseName(theBaseName)
+{
+	fileRecords = 0;
+	if (maxFileSize > 0.0)
+	{
+		double bytes = maxFileSize * 1024.0 * 1024.0 - sizeof(BinaryTraceHeader);
+		fileRecords = (bytes >= sizeof(TraceRecord)) ? (uint64_t) (bytes / sizeof(TraceRecord)) : 1;
+	}
+	mapped = theMapped;
+	users = 0;
+	partition = (ev.getParsimNumPartitions() > 1) ? ev.getParsimProcId() : -1;
+
+	fileIndex = 0;
+	recordCount = 0;
+	buffer = mapped ? NULL : new TraceRecord[windowRecords];
+	window = next = end = NULL;
+	file = NULL;
+	fd = -1;
+	mapping = NULL;
+	mappingLength = 0;
+
+	openFile();
+	startWindow();
+}
+
+BinaryTraceWriter::~BinaryTraceWriter()
+{
+	releaseWindow();
+	closeFile();
+	delete [] buffer;
+}
+
+/*!
+	\brief Create file fileIndex, and write its header.
+*/
+void BinaryTraceWriter::openFile()
+{
+	char suffix[32];
+	if (partition >= 0)
+		sprintf(suffix, ".p%d.%d", partition, fileIndex);
+	else
+		sprintf(suffix, ".%d", fileIndex);
+	std::string path = baseName + suffix;
+
+	BinaryTraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic));
+	header.recordSize = sizeof(TraceRecord);
+	header.fileIndex = fileIndex;
+
+	bool written;
+	if (mapped)
+	{
+		fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		written = (fd >= 0) && (write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header));
+	}
+	else
+	{
+		file = fopen(path.c_str(), "wb");
+		written = (file != NULL) && (fwrite(&header, sizeof(header), 1, file) == 1);
+	}
+	if (!written)
+		opp_error("\n[Mac]:\n Cannot write the binary trace file \"%s\".", path.c_str());
+
+	recordsInFile = 0;
+}
+
+/*!
+	\brief Close the open file. A memory-mapped file is truncated to the records written; the window must have been released.
+*/
+void BinaryTraceWriter::closeFile()
+{
+	bool closed;
+	if (mapped)
+	{
+		closed = (ftruncate(fd, sizeof(BinaryTraceHeader) + recordsInFile * sizeof(TraceRecord)) == 0);
+		closed = (close(fd) == 0) && closed;
+		fd = -1;
+	}
+	else
+	{
+		closed = (fclose(file) == 0);
+		file = NULL;
+	}
+	if (!closed)
+		opp_error("\n[Mac]:\n Cannot write binary trace file %d of \"%s\".", fileIndex, baseName.c_str());
+}
+
+/*!
+	\brief Open a window after the records of the open file, of windowRecords records or the room left in the file.
+
+	A memory-mapped file is extended to hold the window, and the window is mapped; the mapping starts at the page boundary before the window, as mmap() requires.
+*/
+void BinaryTraceWriter::startWindow()
+{
+	size_t numRecords = windowRecords;
+	if ( (fileRecords > 0) && (fileRecords - recordsInFile < numRecords) )
+		numRecords = (size_t) (fileRecords - recordsInFile);
+
+	if (!mapped)
+	{
+		window = next = buffer;
+		end = buffer + numRecords;
+		return;
+	}
+
+	off_t offset = sizeof(BinaryTraceHeader) + recordsInFile * sizeof(TraceRecord);
+	off_t mappingStart = offset - (offset % sysconf(_SC_PAGESIZE));
+	mappingLength = (size_t) (offset - mappingStart) + numRecords * sizeof(TraceRecord);
+
+	if (ftruncate(fd, offset + numRecords * sizeof(TraceRecord)) != 0)
+		opp_error("\n[Mac]:\n Cannot extend binary trace file %d of \"%s\".", fileIndex, baseName.c_str());
+	void *address = mmap(NULL, mappingLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mappingStart);
+	if (address == MAP_FAILED)
+		opp_error("\n[Mac]:\n Cannot map binary trace file %d of \"%s\".", fileIndex, baseName.c_str());
+
+	mapping = (char *) address;
+	window = next = (TraceRecord *) (mapping + (offset - mappingStart));
+	end = window + numRecords;
+}
+
+/*!
+	\brief Hand the records of the window over to the file: write out the buffer, or unmap the window.
+*/
+void BinaryTraceWriter::releaseWindow()
+{
+	size_t used = next - window;
+
+	if (mapped)
+	{
+		munmap(mapping, mappingLength);
+		mapping = NULL;
+	}
+	else if (fwrite(window, sizeof(TraceRecord), used, file) != used)
+		opp_error("\n[Mac]:\n Cannot write binary trace file %d of \"%s\".", fileIndex, baseName.c_str());
+
+	recordsInFile += used;
+	recordCount += used;
+	window = next = end = NULL;
+}
+
+/*!
+	\brief Move on from a full window to the next one, in the next file if the open file is full.
+*/
+void BinaryTraceWriter::nextWindow()
+{
+	releaseWindow();
+
+	if ( (fileRecords > 0) && (recordsInFile >= fileRecords) )
+	{
+		closeFile();
+		fileIndex++;
+		openFile();
+	}
+
+	startWindow();
+}
@@ -0,0 +1,127 @@
+/*!
+	\file BinaryTrace.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definitions for the binary trace of SpeckMAC-D state transitions: the file layout, shared with the reader (tools/spmtrace), and the writer.
+*/
+
+#ifndef BINARYTRACE
+#define BINARYTRACE
+
+#include <cstdio>
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+#define BINARY_TRACE_MAGIC "SPKTRC01" //!< \def Marks the start of a trace file (8 characters, not terminated in the file).
+
+/*!
+	\struct BinaryTraceHeader
+	\brief The header at the start of each trace file. It is the size of a record, so that the records of a memory-mapped file stay aligned.
+*/
+struct BinaryTraceHeader
+{
+	char magic[8]; //!< BINARY_TRACE_MAGIC.
+	uint32_t recordSize; //!< sizeof(TraceRecord), checked by the reader.
+	uint32_t fileIndex; //!< The position of the file in the rotated sequence (0 is the first).
+	uint64_t reserved[2];
+};
+
+/*!
+	\enum TraceRecordTypes
+	\brief The type of a record. Space a memory-mapped file has not filled yet reads as TRACE_RECORD_NONE.
+*/
+enum TraceRecordTypes
+{
+	TRACE_RECORD_NONE = 0,
+	TRACE_RECORD_TRANSITION //!< A change of MAC state.
+};
+
+/*!
+	\struct TraceRecord
+	\brief A fixed-size trace record: one MAC state transition, in native byte order.
+*/
+struct TraceRecord
+{
+	double time; //!< The simulation time of the transition.
+	int64_t eventNumber; //!< The simulation event during which the transition occurred.
+	int32_t node; //!< The ID of the node.
+	int32_t bufferSize; //!< The number of frames in the transmission buffer.
+	uint8_t recordType; //!< See TraceRecordTypes.
+	uint8_t fromState; //!< The state left (see MacStates).
+	uint8_t toState; //!< The state entered.
+	uint8_t event; //!< The event being handled (see MacEvents); MAC_EVENT_UNKNOWN outside the event handlers.
+	uint32_t reserved;
+};
+
+/*!
+ \class BinaryTraceWriter
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Writes TraceRecords to a sequence of files, \<baseName\>.0, \<baseName\>.1, ..., each holding at most a given number of bytes.
+
+ In a parallel simulation, each partition writes files of its own, \<baseName\>.p\<partition\>.0, ..., so that the partitions do not overwrite each other's files.
+
+ A single writer is shared by all the modules of a simulation (see acquire()). Records are filled in place in a window: a buffer that is written out when full, or, if the files are memory-mapped, a mapped part of the file itself. record() hence only stores the fields, and moves to the next window once in a few thousand records.
+*/
+class BinaryTraceWriter
+{
+	private:
+		static BinaryTraceWriter *shared; //!< The writer shared by the modules; NULL if none is open.
+		static const size_t windowRecords = 32768; //!< Number of records in a window (1 MiB).
+
+		std::string baseName; //!< Files are named baseName.<fileIndex>, or baseName.p<partition>.<fileIndex>.
+		int partition; //!< The partition of a parallel simulation that writes the files; -1 in a sequential simulation.
+		uint64_t fileRecords; //!< Largest number of records in a file; 0 if files are not rotated.
+		bool mapped; //!< Indicate whether the files are memory-mapped, instead of written through a buffer.
+		int users; //!< Number of modules that acquired the writer.
+
+		int fileIndex; //!< The index of the open file.
+		uint64_t recordsInFile; //!< Number of records of the open file before the current window.
+		TraceRecord *buffer; //!< The buffer, when files are not memory-mapped.
+		TraceRecord *window; //!< The current window: the buffer, or a part of the mapped file.
+		TraceRecord *next; //!< The next record to fill in the window.
+		TraceRecord *end; //!< The end of the window.
+		long recordCount; //!< Number of records in the previous windows, in all the files.
+
+		FILE *file; //!< The open file, when files are written through a buffer.
+		int fd; //!< The open file, when files are memory-mapped.
+		char *mapping; //!< The mapped part of the file (it starts at a page boundary, at or before window).
+		size_t mappingLength; //!< The length of mapping, in bytes.
+
+		BinaryTraceWriter(const char *theBaseName, double maxFileSize, bool theMapped);
+		~BinaryTraceWriter();
+		BinaryTraceWriter(const BinaryTraceWriter &other); // not copyable.
+		BinaryTraceWriter &operator=(const BinaryTraceWriter &other);
+
+		void openFile();
+		void closeFile();
+		void startWindow();
+		void releaseWindow();
+		void nextWindow();
+
+	public:
+		static BinaryTraceWriter *acquire(const char *baseName, double maxFileSize, bool mapped);
+		void release();
+		long records() const {return recordCount + (next - window);}
+
+		/*!
+			\brief Append a transition record.
+		*/
+		void record(double time, long eventNumber, int node, int fromState, int toState, int event, int bufferSize)
+		{
+			if (next == end)
+				nextWindow();
+
+			TraceRecord *r = next++;
+			r->time = time;
+			r->eventNumber = eventNumber;
+			r->node = node;
+			r->bufferSize = bufferSize;
+			r->recordType = TRACE_RECORD_TRANSITION;
+			r->fromState = (uint8_t) fromState;
+			r->toState = (uint8_t) toState;
+			r->event = (uint8_t) event;
+			r->reserved = 0;
+		}
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*!
+	\file FreeListPool.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of a free-list allocator, used by the short-lived messages created by SpeckMAC-D.
+*/
+
+#ifndef FREELISTPOOL
+#define FREELISTPOOL
+
+#include <cstddef>
+#include <new>
+
+/*!
+ \class FreeListPool
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A free list of memory blocks the size of \b T, shared by all the objects of class \b T in the simulation.
+
+ A class uses the pool by forwarding its class-level operator new and operator delete to allocate() and release(). A released block is kept on the free list, and handed out again by the next allocation, instead of being returned to the heap; at most maxFree blocks are kept. Allocations of a different size (i.e., of a subclass of \b T) are passed on to the global operator new.
+
+ The pool counts the allocations served from the free list (hits), and those that had to go to the heap (misses). clear() returns the free blocks to the heap, and restarts the counts, at the end of a run.
+*/
+template <class T>
+class FreeListPool
+{
+	private:
+		/*!
+			\struct Block
+			\brief A released block, linked into the free list.
+		*/
+		struct Block
+		{
+			Block *next; //!< The next block on the free list.
+		};
+
+		static Block *freeList; //!< The released blocks.
+		static unsigned int numFree; //!< The number of blocks on the free list.
+		static long numHits; //!< The number of allocations served from the free list.
+		static long numMisses; //!< The number of allocations served by the heap.
+
+	public:
+		static const unsigned int maxFree = 4096; //!< The maximum number of blocks kept on the free list.
+
+		static void *allocate(size_t size)
+		{
+			if ( (size != sizeof(T)) || (freeList == NULL) )
+			{
+				numMisses++;
+				return ::operator new(size);
+			}
+
+			numHits++;
+			Block *block = freeList;
+			freeList = block->next;
+			numFree--;
+			return block;
+		}
+
+		static void release(void *p, size_t size)
+		{
+			if (p == NULL)
+				return;
+
+			if ( (size != sizeof(T)) || (numFree >= maxFree) )
+			{
+				::operator delete(p);
+				return;
+			}
+
+			Block *block = static_cast<Block *>(p);
+			block->next = freeList;
+			freeList = block;
+			numFree++;
+		}
+
+		static long hits() {return numHits;}
+		static long misses() {return numMisses;}
+
+		/*!
+			\brief Return the blocks of the free list to the heap, and reset the counters. Objects still allocated may be released afterwards.
+		*/
+		static void clear()
+		{
+			while (freeList != NULL)
+			{
+				Block *block = freeList;
+				freeList = block->next;
+				::operator delete(block);
+			}
+			numFree = 0;
+			numHits = numMisses = 0;
+		}
+};
+
+template <class T> typename FreeListPool<T>::Block *FreeListPool<T>::freeList = NULL;
+template <class T> unsigned int FreeListPool<T>::numFree = 0;
+template <class T> long FreeListPool<T>::numHits = 0;
+template <class T> long FreeListPool<T>::numMisses = 0;
+
+#endif
@@ -0,0 +1,109 @@
+/*!
+	\file LocalClock.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the local clock of a node, used by SpeckMAC-D to convert the durations it measures with its own timer into simulation time.
+*/
+
+#ifndef LOCALCLOCK
+#define LOCALCLOCK
+
+#include <cmath>
+
+/*!
+ \class LocalClock
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A drifting clock, whose skew may vary with the temperature of the node.
+
+ A local duration d lasts d * skew in simulation time. The skew is a fixed drift, set from the CPU clock drift of the node, which may wander with a daily temperature cycle: skew(t) = drift * (1 + wanderAmplitude * sin(2 pi t / wanderPeriod + wanderPhase)).
+
+ The skew is updated lazily: a conversion made updateInterval or more after the last update recomputes it, and the other conversions are a single multiplication. Without wander, the skew is never recomputed.
+*/
+class LocalClock
+{
+	private:
+		double drift; //!< The fixed part of the skew (1 is a perfect clock).
+		double wanderAmplitude; //!< The relative amplitude of the temperature-driven variation of the skew; 0 if the skew is fixed.
+		double wanderPeriod; //!< The period of the variation, in seconds of simulation time.
+		double wanderPhase; //!< The phase of the variation at time 0, in radians.
+		double updateInterval; //!< Shortest time between two updates of the skew.
+		double skew; //!< The skew as of the last update.
+		double nextUpdate; //!< The time from which a conversion updates the skew.
+
+		void update(double now)
+		{
+			skew = drift * (1.0 + wanderAmplitude * sin(2.0 * M_PI * now / wanderPeriod + wanderPhase));
+			nextUpdate = now + updateInterval;
+		}
+
+	public:
+		LocalClock() : drift(1.0), wanderAmplitude(0.0), wanderPeriod(1.0), wanderPhase(0.0), updateInterval(0.0), skew(1.0), nextUpdate(HUGE_VAL) {}
+
+		/*!
+			\brief Set the fixed drift of the clock, e.g. ResourceGenericManager::getCPUClockDrift(). The skew no longer wanders.
+		*/
+		void setDrift(double theDrift)
+		{
+			drift = skew = theDrift;
+			wanderAmplitude = 0.0;
+			nextUpdate = HUGE_VAL;
+		}
+
+		/*!
+			\brief Let the skew wander by \b amplitude (relative to the drift) over a cycle of \b period seconds, starting at \b phase, and recompute it at most once per \b theUpdateInterval. An amplitude of 0 keeps the skew fixed.
+		*/
+		void setWander(double amplitude, double period, double phase, double theUpdateInterval)
+		{
+			if (amplitude == 0.0)
+				return;
+
+			wanderAmplitude = amplitude;
+			wanderPeriod = period;
+			wanderPhase = phase;
+			updateInterval = theUpdateInterval;
+			nextUpdate = 0.0;
+		}
+
+		/*!
+			\brief Convert \b localDuration, measured by the node's timer from \b now, into simulation time.
+		*/
+		double toSimTime(double localDuration, double now)
+		{
+			if (now >= nextUpdate)
+				update(now);
+			return localDuration * skew;
+		}
+
+		/*!
+			\brief Convert \b simDuration, ending at \b now, into the duration the node's timer measures.
+		*/
+		double toLocalTime(double simDuration, double now)
+		{
+			if (now >= nextUpdate)
+				update(now);
+			return simDuration / skew;
+		}
+
+		/*!
+			\brief The skew as of the last conversion.
+		*/
+		double currentSkew() const {return skew;}
+		
+		/*!
+			\brief The phase of the variation at \b now, in radians.
+		*/
+		double phaseAt(double now) const {return fmod(2.0 * M_PI * now / wanderPeriod + wanderPhase, 2.0 * M_PI);}
+		
+		double nextUpdateTime() const {return nextUpdate;} //!< The time from which a conversion updates the skew.
+		
+		/*!
+			\brief Resume the clock of another run: at \b now, the variation is at phase \b phase, the skew is \b theSkew, and it is next updated at \b theNextUpdate. The drift and the wander, if any, must have been set as in that run.
+		*/
+		void restore(double phase, double theSkew, double theNextUpdate, double now)
+		{
+			wanderPhase = phase - 2.0 * M_PI * now / wanderPeriod;
+			skew = theSkew;
+			nextUpdate = theNextUpdate;
+		}
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*!
+	\file MultiLevelQueue.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of a multi-level priority queue built from ring buffers, used for the SpeckMAC-D transmission buffer.
+*/
+
+#ifndef MULTILEVELQUEUE
+#define MULTILEVELQUEUE
+
+#include <cstddef>
+#include "RingBuffer.h"
+
+/*!
+ \class MultiLevelQueue
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A fixed-capacity queue with a FIFO RingBuffer per priority level.
+
+ Level 0 is the most urgent, as with cMessage priorities. pop() and front() serve the most urgent non-empty level; items of the same level are served in FIFO order. The capacity is shared by all the levels. With a single level, the queue is a plain RingBuffer.
+
+ The queue does not own the items it holds.
+*/
+template <class T>
+class MultiLevelQueue
+{
+	private:
+		RingBuffer<T> *levels; //!< The ring buffer of each level; each can hold the whole capacity.
+		unsigned int numLevels; //!< The number of levels.
+		unsigned int count; //!< The number of items held in all the levels.
+		unsigned int limit; //!< The capacity of the queue.
+
+		MultiLevelQueue(const MultiLevelQueue &other); // not copyable.
+		MultiLevelQueue &operator=(const MultiLevelQueue &other);
+
+		/*!
+			\brief The most urgent non-empty level. The queue must not be empty.
+		*/
+		unsigned int firstLevel() const
+		{
+			unsigned int level = 0;
+			while (levels[level].empty())
+				level++;
+			return level;
+		}
+
+	public:
+		MultiLevelQueue() : levels(NULL), numLevels(0), count(0), limit(0) {}
+		~MultiLevelQueue() {delete [] levels;}
+
+		/*!
+			\brief Allocate \b theNumLevels levels, sharing a capacity of \b capacity items. Any items held are discarded.
+		*/
+		void setCapacity(unsigned int theNumLevels, unsigned int capacity)
+		{
+			delete [] levels;
+			numLevels = (theNumLevels > 0) ? theNumLevels : 1;
+			levels = new RingBuffer<T>[numLevels];
+			for (unsigned int level = 0; level < numLevels; level++)
+				levels[level].setCapacity(capacity);
+			count = 0;
+			limit = capacity;
+		}
+
+		unsigned int capacity() const {return limit;}
+		unsigned int levelCount() const {return numLevels;}
+		unsigned int size() const {return count;}
+		bool empty() const {return (count == 0);}
+		bool full() const {return (count >= limit);}
+
+		/*!
+			\brief Push an item at the tail of level \b level (clamped to the least urgent level). Returns false, and does not push the item, if the queue is full.
+		*/
+		bool push(const T &item, unsigned int level = 0)
+		{
+			if (full())
+				return false;
+			if (level >= numLevels)
+				level = numLevels - 1;
+			levels[level].push(item);
+			count++;
+			return true;
+		}
+
+		/*!
+			\brief Pop the oldest item of the most urgent non-empty level. The queue must not be empty.
+		*/
+		T pop()
+		{
+			count--;
+			return levels[firstLevel()].pop();
+		}
+
+		/*!
+			\brief The item pop() would return. The queue must not be empty.
+		*/
+		T &front() {return levels[firstLevel()].front();}
+
+		/*!
+			\brief The least urgent non-empty level. The queue must not be empty.
+		*/
+		unsigned int lastLevel() const
+		{
+			unsigned int level = numLevels - 1;
+			while (levels[level].empty())
+				level--;
+			return level;
+		}
+
+		/*!
+			\brief The number of items held in level \b level.
+		*/
+		unsigned int levelSize(unsigned int level) const {return levels[level].size();}
+
+		/*!
+			\brief The \b i th oldest item of level \b level, without removing it; \b i must be less than levelSize(level).
+		*/
+		T &at(unsigned int level, unsigned int i) {return levels[level].at(i);}
+
+		/*!
+			\brief Pop the oldest item of level \b level, which must not be empty.
+		*/
+		T popLevel(unsigned int level)
+		{
+			count--;
+			return levels[level].pop();
+		}
+};
+
+#endif
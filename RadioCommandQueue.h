@@ -0,0 +1,61 @@
+/*!
+	\file RadioCommandQueue.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the queue of radio state commands that SpeckMAC-D has sent, and that have not taken effect yet.
+*/
+
+#ifndef RADIOCOMMANDQUEUE
+#define RADIOCOMMANDQUEUE
+
+#include <deque>
+
+/*!
+ \class RadioCommandQueue
+ \author Siddhu Warrier, University of Edinburgh
+ \brief The state commands sent to the radio, in the order in which they take effect.
+
+ Commands are sent with different delays, so a command sent later may take effect earlier (e.g. a sleep sent while a train of delayed transmit commands is pending). Commands that take effect at the same time stay in the order they were sent, in which the radio receives them. The queue holds a handful of commands: insertion scans from the back, and the commands due are taken from the front.
+*/
+class RadioCommandQueue
+{
+	private:
+		/*!
+			\struct Command
+			\brief A state command, and the time it takes effect.
+		*/
+		struct Command
+		{
+			double when; //!< The time the command takes effect.
+			int typeID; //!< The command (MAC_2_RADIO_ENTER_SLEEP, MAC_2_RADIO_ENTER_LISTEN or MAC_2_RADIO_ENTER_TX).
+		};
+
+		std::deque<Command> commands; //!< The pending commands, ordered by the time they take effect.
+
+	public:
+		/*!
+			\brief Add command \b typeID, which takes effect at \b when, after the commands that take effect at or before \b when.
+		*/
+		void push(double when, int typeID)
+		{
+			Command command = {when, typeID};
+
+			std::deque<Command>::iterator position = commands.end();
+			while ( (position != commands.begin()) && ((position - 1)->when > when) )
+				--position;
+			commands.insert(position, command);
+		}
+
+		/*!
+			\brief Check whether the first command takes effect at or before \b now.
+		*/
+		bool due(double now) const {return !commands.empty() && (commands.front().when <= now);}
+
+		double frontTime() const {return commands.front().when;} //!< The time the first command takes effect.
+		int frontCommand() const {return commands.front().typeID;} //!< The first command.
+		double backTime() const {return commands.back().when;} //!< The time the last command takes effect.
+		void pop() {commands.pop_front();} //!< Remove the first command.
+		bool empty() const {return commands.empty();}
+		void clear() {commands.clear();}
+};
+
+#endif
@@ -0,0 +1,85 @@
+/*!
+	\file RingBuffer.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of a fixed-capacity ring buffer, used for the SpeckMAC-D transmission buffer.
+*/
+
+#ifndef RINGBUFFER
+#define RINGBUFFER
+
+#include <cstddef>
+
+/*!
+ \class RingBuffer
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A fixed-capacity FIFO ring buffer.
+
+ The storage is rounded up to a power of two, so that positions are obtained by masking free-running head and tail counters instead of using a modulo. The counters are unsigned, so size() = tail - head remains correct when they wrap around. size(), empty() and full() do not branch.
+ 
+ The buffer does not own the items it holds.
+*/
+template <class T>
+class RingBuffer
+{
+	private:
+		T *items; //!< The storage; its size is a power of two.
+		unsigned int mask; //!< The size of the storage, minus one.
+		unsigned int limit; //!< The capacity of the buffer (may be smaller than the storage).
+		unsigned int head; //!< Number of items popped so far (pop position).
+		unsigned int tail; //!< Number of items pushed so far (push position).
+		
+		RingBuffer(const RingBuffer &other); // not copyable.
+		RingBuffer &operator=(const RingBuffer &other);
+		
+	public:
+		RingBuffer() : items(NULL), mask(0), limit(0), head(0), tail(0) {}
+		~RingBuffer() {delete [] items;}
+		
+		/*!
+			\brief Allocate storage for \b capacity items. Any items held are discarded.
+		*/
+		void setCapacity(unsigned int capacity)
+		{
+			unsigned int storageSize = 1;
+			while (storageSize < capacity)
+				storageSize <<= 1;
+			
+			delete [] items;
+			items = new T[storageSize];
+			mask = storageSize - 1;
+			limit = capacity;
+			head = tail = 0;
+		}
+		
+		unsigned int capacity() const {return limit;}
+		unsigned int size() const {return tail - head;}
+		bool empty() const {return (tail == head);}
+		bool full() const {return ((tail - head) >= limit);}
+		
+		/*!
+			\brief Push an item at the tail of the buffer. Returns false, and does not push the item, if the buffer is full.
+		*/
+		bool push(const T &item)
+		{
+			if (full())
+				return false;
+			items[tail++ & mask] = item;
+			return true;
+		}
+		
+		/*!
+			\brief Pop the item at the head of the buffer. The buffer must not be empty.
+		*/
+		T pop() {return items[head++ & mask];}
+		
+		/*!
+			\brief Access the item at position \b i from the head of the buffer (0 is the head). \b i must be smaller than size().
+		*/
+		T &at(unsigned int i) {return items[(head + i) & mask];}
+		
+		T &front() {return items[head & mask];}
+		
+		void clear() {head = tail = 0;}
+};
+
+#endif
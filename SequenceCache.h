@@ -0,0 +1,79 @@
+/*!
+	\file SequenceCache.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of a fixed-size cache of the last sequence number received from each neighbour, used to suppress duplicate SpeckMAC-D frames.
+*/
+
+#ifndef SEQUENCECACHE
+#define SEQUENCECACHE
+
+#include <cstddef>
+
+/*!
+ \class SequenceCache
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A direct-mapped cache of (source ID -> last sequence number received).
+
+ The number of entries is rounded up to a power of two, and a source is mapped to an entry by masking its ID, so that a lookup is a single array access. The entries are kept in one contiguous array of small structs.
+
+ Two sources that map to the same entry evict each other. A duplicate is then not recognised if frames from the two sources interleave; the cache never reports a frame as a duplicate wrongly.
+*/
+class SequenceCache
+{
+	private:
+		/*!
+			\struct Entry
+			\brief The last sequence number received from a source.
+		*/
+		struct Entry
+		{
+			int srcID; //!< The source; -1 if the entry is unused.
+			int seqNum; //!< The last sequence number received from the source.
+		};
+
+		Entry *entries; //!< The entries; their number is a power of two.
+		unsigned int mask; //!< The number of entries, minus one.
+
+		SequenceCache(const SequenceCache &other); // not copyable.
+		SequenceCache &operator=(const SequenceCache &other);
+
+	public:
+		SequenceCache() : entries(NULL), mask(0) {}
+		~SequenceCache() {delete [] entries;}
+
+		/*!
+			\brief Allocate at least \b size entries. Any sequence numbers held are discarded.
+		*/
+		void setSize(unsigned int size)
+		{
+			unsigned int numEntries = 1;
+			while (numEntries < size)
+				numEntries <<= 1;
+
+			delete [] entries;
+			entries = new Entry[numEntries];
+			mask = numEntries - 1;
+
+			for (unsigned int i = 0; i < numEntries; i++)
+				entries[i].srcID = -1;
+		}
+
+		/*!
+			\brief Record that frame \b seqNum was received from \b srcID.
+
+			\return true if it is the last frame recorded for \b srcID, i.e., the frame is a duplicate.
+		*/
+		bool isDuplicate(int srcID, int seqNum)
+		{
+			Entry &entry = entries[(unsigned int) srcID & mask];
+
+			if ( (entry.srcID == srcID) && (entry.seqNum == seqNum) )
+				return true;
+
+			entry.srcID = srcID;
+			entry.seqNum = seqNum;
+			return false;
+		}
+};
+
+#endif
@@ -0,0 +1,32 @@
+/*!
+	\file SpeckMacControlMessage.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the pooled control message, used for the commands SpeckMAC-D sends to the radio and the network layer.
+*/
+
+#ifndef SPECKMACCONTROLMESSAGE
+#define SPECKMACCONTROLMESSAGE
+
+#include <omnetpp.h>
+#include "MacControlMessage_m.h"
+#include "FreeListPool.h"
+
+/*!
+ \class SpeckMacControlMessage
+ \author Siddhu Warrier, University of Edinburgh
+ \brief A MAC_ControlMessage allocated from a FreeListPool.
+
+ Radio state commands, carrier sense strobes and full buffer notifications live only until the receiving module deletes them, and a node sends several of them on every wakeup. They are allocated from a free list rather than from the heap; the receiving module deletes them as any other MAC_ControlMessage.
+*/
+class SpeckMacControlMessage : public MAC_ControlMessage
+{
+	public:
+		SpeckMacControlMessage(const char *name = NULL, int kind = 0) : MAC_ControlMessage(name, kind) {}
+		SpeckMacControlMessage(const SpeckMacControlMessage &other) : MAC_ControlMessage(other) {}
+		virtual cPolymorphic *dup() const {return new SpeckMacControlMessage(*this);}
+
+		static void *operator new(size_t size) {return FreeListPool<SpeckMacControlMessage>::allocate(size);}
+		static void operator delete(void *p, size_t size) {FreeListPool<SpeckMacControlMessage>::release(p, size);}
+};
+
+#endif
@@ -0,0 +1,257 @@
+/*!
+	\file SpeckMacFrame.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the SpeckMAC-D data frame and its shared payload.
+*/
+
+#include "SpeckMacFrame.h"
+
+Register_Class(SpeckMacFrame);
+
+/*!
+	\brief Wrap a network frame. The payload takes ownership of the frame, and holds a single reference.
+*/
+SpeckMacPayload::SpeckMacPayload(Network_GenericFrame *theFrame)
+{
+	networkFrames.push_back(theFrame);
+	totalLength = theFrame->byteLength();
+	refCount = 1;
+}
+
+SpeckMacPayload::~SpeckMacPayload()
+{
+	for (unsigned int i = 0; i < networkFrames.size(); i++)
+		delete networkFrames[i]; // NULL if extracted.
+	networkFrames.clear();
+}
+
+/*!
+	\brief Add a reference to the payload.
+*/
+SpeckMacPayload *SpeckMacPayload::acquire()
+{
+	refCount++;
+	return this;
+}
+
+/*!
+	\brief Remove a reference to the payload, and delete it if it was the last one.
+*/
+void SpeckMacPayload::release()
+{
+	if (--refCount == 0)
+		delete this;
+}
+
+/*!
+	\brief Add a network frame at the end of the payload. The payload takes ownership of the frame.
+*/
+void SpeckMacPayload::append(Network_GenericFrame *theFrame)
+{
+	if (isShared())
+		opp_error("SpeckMacPayload: attempt to modify a shared payload");
+	
+	networkFrames.push_back(theFrame);
+	totalLength += theFrame->byteLength();
+}
+
+/*!
+	\brief Move the network frames of another payload to the end of this one. The other payload is left empty.
+*/
+void SpeckMacPayload::absorb(SpeckMacPayload *other)
+{
+	if (isShared() || other->isShared())
+		opp_error("SpeckMacPayload: attempt to modify a shared payload");
+	
+	networkFrames.insert(networkFrames.end(), other->networkFrames.begin(), other->networkFrames.end());
+	totalLength += other->totalLength;
+	
+	other->networkFrames.clear();
+	other->totalLength = 0;
+}
+
+/*!
+	\brief Obtain the \b i th network frame, so that it may be handed over to the network layer.
+	
+	If only one MAC frame refers to the payload, the network frame itself is handed over and no copy is made. Otherwise, a copy is returned, as the other MAC frames still refer to the network frame.
+	
+	\note The caller must release its reference once it has extracted the frames it needs.
+*/
+Network_GenericFrame *SpeckMacPayload::extractFrame(int i)
+{
+	if (isShared())
+		return check_and_cast<Network_GenericFrame *>(networkFrames[i]->dup());
+	
+	Network_GenericFrame *theFrame = networkFrames[i];
+	networkFrames[i] = NULL;
+	return theFrame;
+}
+
+SpeckMacFrame::SpeckMacFrame(const char *name, int kind) : MAC_GenericFrame(name, kind)
+{
+	payload = NULL;
+	seqNum = 0;
+	trainIndex = 0;
+	trainLength = 1;
+	copyGap = 0.0;
+	sleepInterval = 0.0;
+	txPriority = 0;
+	deadline = 0.0;
+}
+
+SpeckMacFrame::SpeckMacFrame(const SpeckMacFrame &other) : MAC_GenericFrame(other)
+{
+	payload = NULL;
+	copy(other);
+}
+
+SpeckMacFrame::~SpeckMacFrame()
+{
+	if (payload != NULL)
+		payload->release();
+	payload = NULL;
+}
+
+SpeckMacFrame &SpeckMacFrame::operator=(const SpeckMacFrame &other)
+{
+	if (this == &other)
+		return *this;
+	
+	MAC_GenericFrame::operator=(other);
+	copy(other);
+	return *this;
+}
+
+/*!
+	\brief Copy the SpeckMAC-D specific fields. The payload is shared, not copied.
+*/
+void SpeckMacFrame::copy(const SpeckMacFrame &other)
+{
+	seqNum = other.seqNum;
+	trainIndex = other.trainIndex;
+	trainLength = other.trainLength;
+	copyGap = other.copyGap;
+	sleepInterval = other.sleepInterval;
+	txPriority = other.txPriority;
+	deadline = other.deadline;
+	
+	if (other.payload != NULL)
+		other.payload->acquire();
+	if (payload != NULL)
+		payload->release();
+	payload = other.payload;
+}
+
+/*!
+	\brief Attach a network frame to the MAC frame.
+	
+	The frame takes ownership of the network frame, and its length is increased by the length of the network frame (as encapsulate() would do). If a payload is already attached, the network frame is added to it; this is only allowed before the frame is copied.
+	The network frame should have been dropped by its owner module before this method is called.
+*/
+void SpeckMacFrame::attachPayload(Network_GenericFrame *networkFrame)
+{
+	if (payload == NULL)
+		payload = new SpeckMacPayload(networkFrame);
+	else
+		payload->append(networkFrame);
+	
+	setByteLength(byteLength() + networkFrame->byteLength());
+}
+
+/*!
+	\brief Move the network frames carried by another frame into this frame.
+	
+	The length of this frame is increased by the length of the moved network frames only: the MAC header of the other frame is not sent. The other frame is left without a payload, and may be deleted. Neither frame may have been copied.
+*/
+void SpeckMacFrame::aggregate(SpeckMacFrame *other)
+{
+	if (other->payload == NULL)
+		return;
+	
+	int movedLength = other->payload->byteLength();
+	
+	if (payload == NULL)
+		payload = other->payload->acquire();
+	else
+		payload->absorb(other->payload);
+	other->payload->release();
+	other->payload = NULL;
+	other->setByteLength(other->byteLength() - movedLength);
+	
+	setByteLength(byteLength() + movedLength);
+}
+
+/*!
+	\brief Detach the network frames from the MAC frame (as decapsulate() would do).
+	
+	The network frames are copied only if other copies of the MAC frame still refer to them. The caller must take() ownership of the returned frames before sending them.
+	
+	\param networkFrames
+	The network frames are appended to this vector, in the order they were attached.
+	\return The number of network frames detached.
+*/
+int SpeckMacFrame::detachPayload(std::vector<Network_GenericFrame *> &networkFrames)
+{
+	if (payload == NULL)
+		return 0;
+	
+	int numFrames = payload->frameCount();
+	for (int i = 0; i < numFrames; i++)
+		networkFrames.push_back(payload->extractFrame(i));
+	
+	setByteLength(byteLength() - payload->byteLength());
+	payload->release();
+	payload = NULL;
+	
+	return numFrames;
+}
+
+/*!
+	\brief Serialise the frame, for parallel simulation. The network frames of the payload are packed with it; copies that share the payload are packed separately.
+*/
+void SpeckMacFrame::netPack(cCommBuffer *b)
+{
+	MAC_GenericFrame::netPack(b);
+	b->pack(seqNum);
+	b->pack(trainIndex);
+	b->pack(trainLength);
+	b->pack(copyGap);
+	b->pack(sleepInterval);
+	b->pack(txPriority);
+	b->pack(deadline);
+	
+	int numFrames = (payload != NULL) ? payload->frameCount() : 0;
+	b->pack(numFrames);
+	for (int i = 0; i < numFrames; i++)
+		b->packObject(payload->frame(i));
+}
+
+/*!
+	\brief Deserialise a frame packed by netPack(). The frame gets a payload of its own; its length, restored with the MAC header, already includes the network frames.
+*/
+void SpeckMacFrame::netUnpack(cCommBuffer *b)
+{
+	MAC_GenericFrame::netUnpack(b);
+	b->unpack(seqNum);
+	b->unpack(trainIndex);
+	b->unpack(trainLength);
+	b->unpack(copyGap);
+	b->unpack(sleepInterval);
+	b->unpack(txPriority);
+	b->unpack(deadline);
+	
+	if (payload != NULL)
+		payload->release();
+	payload = NULL;
+	
+	int numFrames;
+	b->unpack(numFrames);
+	for (int i = 0; i < numFrames; i++)
+	{
+		Network_GenericFrame *networkFrame = check_and_cast<Network_GenericFrame *>(b->unpackObject());
+		if (payload == NULL)
+			payload = new SpeckMacPayload(networkFrame);
+		else
+			payload->append(networkFrame);
+	}
+}
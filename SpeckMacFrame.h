@@ -0,0 +1,103 @@
+/*!
+	\file SpeckMacFrame.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definitions for the SpeckMAC-D data frame, used to send redundant copies of a frame without copying its payload.
+*/
+
+#ifndef SPECKMACFRAME
+#define SPECKMACFRAME
+
+#include <vector>
+#include <omnetpp.h>
+#include "NetworkGenericFrame_m.h"
+#include "MacGenericFrame_m.h"
+#include "FreeListPool.h"
+
+/*!
+ \class SpeckMacPayload
+ \author Siddhu Warrier, University of Edinburgh
+ \brief The reference-counted network frames carried by a SpeckMAC-D frame, shared by all of its copies.
+
+ A payload usually holds a single network frame; several network frames are held when queued frames are aggregated. The payload may only be modified while a single frame refers to it. It is deleted when the last frame referring to it is deleted.
+*/
+class SpeckMacPayload
+{
+	private:
+		std::vector<Network_GenericFrame *> networkFrames; //!< The network frames carried by the MAC frames, in the order they were attached.
+		int refCount; //!< The number of MAC frames referring to this payload.
+		int totalLength; //!< The total length of the network frames, in bytes.
+		
+	public:
+		SpeckMacPayload(Network_GenericFrame *theFrame);
+		~SpeckMacPayload();
+		
+		SpeckMacPayload *acquire();
+		void release();
+		bool isShared() const {return (refCount > 1);}
+		int byteLength() const {return totalLength;}
+		int frameCount() const {return networkFrames.size();}
+		void append(Network_GenericFrame *theFrame);
+		void absorb(SpeckMacPayload *other);
+		Network_GenericFrame *extractFrame(int i);
+		Network_GenericFrame *frame(int i) {return networkFrames[i];}
+};
+
+/*!
+ \class SpeckMacFrame
+ \author Siddhu Warrier, University of Edinburgh
+ \brief The SpeckMAC-D data frame.
+
+ This class is used instead of encapsulating a network frame in a MAC_GenericFrame. The network frame is held in a shared SpeckMacPayload, so dup() only copies the MAC header. The redundant copies sent by SpeckMAC-D, and the copies made by the radio and the wireless channel, hence do not copy the network frame.
+ The frames themselves are allocated from a FreeListPool.
+*/
+class SpeckMacFrame : public MAC_GenericFrame
+{
+	private:
+		SpeckMacPayload *payload; //!< The shared payload; NULL if the frame does not carry a network frame.
+		int seqNum; //!< The MAC sequence number, set by the sender; all copies of a frame carry the same number.
+		int trainIndex; //!< The index of this copy in the redundant train (0 is the first copy).
+		int trainLength; //!< The number of copies in the redundant train.
+		double copyGap; //!< The time the sender leaves between the end of a copy and the start of the next one, in its local time: 0 if the copies are sent back to back.
+		double sleepInterval; //!< The sleep interval of the sender, advertised to the receivers (adaptive duty cycle); 0 if not set.
+		int txPriority; //!< The transmission buffer level of the frame at the sender (0 is the most urgent).
+		double deadline; //!< The time after which the sender drops the frame instead of sending it; 0 if the frame does not expire.
+		
+		void copy(const SpeckMacFrame &other);
+		
+	public:
+		SpeckMacFrame(const char *name = NULL, int kind = 0);
+		SpeckMacFrame(const SpeckMacFrame &other);
+		virtual ~SpeckMacFrame();
+		SpeckMacFrame &operator=(const SpeckMacFrame &other);
+		virtual cPolymorphic *dup() const {return new SpeckMacFrame(*this);}
+		
+		static void *operator new(size_t size) {return FreeListPool<SpeckMacFrame>::allocate(size);}
+		static void operator delete(void *p, size_t size) {FreeListPool<SpeckMacFrame>::release(p, size);}
+		
+		void attachPayload(Network_GenericFrame *networkFrame);
+		void aggregate(SpeckMacFrame *other);
+		int getSeqNum() const {return seqNum;}
+		void setSeqNum(int theSeqNum) {seqNum = theSeqNum;}
+		int getTrainIndex() const {return trainIndex;}
+		void setTrainIndex(int theTrainIndex) {trainIndex = theTrainIndex;}
+		int getTrainLength() const {return trainLength;}
+		void setTrainLength(int theTrainLength) {trainLength = theTrainLength;}
+		double getCopyGap() const {return copyGap;}
+		void setCopyGap(double theCopyGap) {copyGap = theCopyGap;}
+		double getSleepInterval() const {return sleepInterval;}
+		void setSleepInterval(double theSleepInterval) {sleepInterval = theSleepInterval;}
+		int getTxPriority() const {return txPriority;}
+		void setTxPriority(int theTxPriority) {txPriority = theTxPriority;}
+		double getDeadline() const {return deadline;}
+		void setDeadline(double theDeadline) {deadline = theDeadline;}
+		bool isExpired(double now) const {return (deadline > 0.0) && (now > deadline);}
+		int copiesRemaining() const {return trainLength - trainIndex - 1;}
+		bool hasPayload() const {return (payload != NULL);}
+		int payloadLength() const {return (payload != NULL) ? payload->byteLength() : 0;}
+		int detachPayload(std::vector<Network_GenericFrame *> &networkFrames);
+		
+		virtual void netPack(cCommBuffer *b);
+		virtual void netUnpack(cCommBuffer *b);
+};
+
+#endif
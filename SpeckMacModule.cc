@@ -7,93 +7,411 @@
 
 #include "SpeckMacModule.h"
 
-#define BLOCKING
-#define DEBUG
-
 Define_Module(SpeckMacModule);
+Register_Class(SpeckMacControlMessage); // created by name when unpacked, in parallel simulation.
+
+/*!
+	\brief Marks the start of a checkpoint file; the last two characters are the version of the state layout (see transferState()).
+*/
+static const char checkpointMagic[8] = {'S', 'P', 'K', 'M', 'A', 'C', '0', '4'};
+
+/*!
+	\brief Number of modules of the run, in this process, that have not finished yet; the last one to finish records the counters of the shared message pools, and releases them.
+*/
+static int unfinishedModules = 0;
+
+/*!
+	\brief The delay of the connection from \b outGate to the gate it leads to, summed over the channels of the path.
+*/
+static double connectionDelay(cGate *outGate)
+{
+	double delay = 0.0;
+	for (cGate *g = outGate; g->toGate() != NULL; g = g->toGate())
+	{
+		cBasicChannel *channel = dynamic_cast<cBasicChannel *>(g->channel());
+		if ( (channel != NULL) && (channel->delay() != NULL) )
+			delay += (double) *channel->delay();
+	}
+	return delay;
+}
+
+/*!
+	\brief Names of the MAC states, indexed by state.
+*/
+static const char *macStateNames[MAC_STATE_COUNT] =
+{
+	"MAC_STATE_DEFAULT",
+	"MAC_STATE_TX",
+	"MAC_STATE_CARRIER_SENSING",
+	"MAC_STATE_EXPECTING_RX",
+	"MAC_STATE_TRY_TX"
+};
+
+/*!
+	\struct MacEventInfo
+	\brief Static description of a SpeckMAC-D event.
+*/
+struct MacEventInfo
+{
+	const char *name; //!< Name of the message kind that causes the event.
+	bool takesOwnership; //!< Indicate whether the handlers of the event take ownership of the message.
+};
+
+/*!
+	\brief Descriptions of the events, indexed by event.
+*/
+static const MacEventInfo macEventInfo[MAC_EVENT_COUNT] =
+{
+	{"APP_NODE_STARTUP", false},
+	{"MAC_SELF_SET_RADIO_SLEEP", false},
+	{"MAC_SELF_WAKEUP_RADIO", false},
+	{"NET_FRAME", true},
+	{"MAC_FRAME_SELF_PUSH_TX_BUFFER", true},
+	{"MAC_SELF_INITIATE_TX", false},
+	{"MAC_SELF_PERFORM_CARRIER_SENSE", false},
+	{"RADIO_2_MAC_SENSED_CARRIER", false},
+	{"MAC_SELF_EXIT_CARRIER_SENSE", false},
+	{"MAC_SELF_CHECK_TX_BUFFER", false},
+	{"RADIO_2_MAC_STARTED_TX", false},
+	{"RADIO_2_MAC_STOPPED_TX", false},
+	{"MAC_FRAME", false},
+	{"RESOURCE_MGR_OUT_OF_ENERGY", false},
+	{"SPECKMAC_SELF_ACK_TIMEOUT", false}
+};
+
+#define ON(method) &SpeckMacModule::dispatch<&SpeckMacModule::method> //!< \def Table entry for a handler that does not take the message.
+#define ON_MSG(method) &SpeckMacModule::method //!< \def Table entry for a handler that takes the message.
+#define REJECT NULL //!< \def Table entry for an event that is rejected in a state.
+
+/*!
+	\brief The SpeckMAC-D (state x event) transition table.
+	
+	Each entry is the handler of an event (column, see MacEvents) in a state (row, see MacStates), or REJECT if the event is not handled in that state. The table is built at compile time; handleMessage() dispatches each event with a single lookup.
+*/
+const SpeckMacModule::MacEventHandler SpeckMacModule::transitionTable[MAC_STATE_COUNT][MAC_EVENT_COUNT] =
+{
+	// MAC_STATE_DEFAULT
+	{ON(nodeStartup), ON(dutyCycleSleep), ON(dutyCycleWakeup), ON_MSG(handleNetworkLayerFrame), ON_MSG(pushFrameIntoBuffer), ON(initiateTransmission), ON(performCarrierSense), ON(carrierBusy), REJECT, ON(sendData), ON(txStarted), ON(sleepUntilNextWakeup), ON_MSG(receiveFrame), ON(outOfEnergy), REJECT},
+	// MAC_STATE_TX
+	{ON(nodeStartup), REJECT, REJECT, ON_MSG(handleNetworkLayerFrame), ON_MSG(pushFrameIntoBuffer), REJECT, REJECT, REJECT, REJECT, ON(sendData), ON(ignoreEvent), ON(finishDataTransmission), ON_MSG(receiveFrame), ON(outOfEnergy), ON(ackTimeout)},
+	// MAC_STATE_CARRIER_SENSING
+	{ON(nodeStartup), REJECT, REJECT, ON_MSG(handleNetworkLayerFrame), ON_MSG(pushFrameIntoBuffer), REJECT, REJECT, ON(carrierBusy), ON(carrierFree), ON(unexpectedTxBufferCheck), ON(txStartedWhileSensing), ON(sleepUntilNextWakeup), ON_MSG(receiveFrame), ON(outOfEnergy), REJECT},
+	// MAC_STATE_EXPECTING_RX
+	{ON(nodeStartup), ON(expectedRxFailed), REJECT, ON_MSG(handleNetworkLayerFrame), ON_MSG(pushFrameIntoBuffer), REJECT, REJECT, REJECT, REJECT, ON(unexpectedTxBufferCheck), REJECT, ON(sleepUntilNextWakeup), ON_MSG(receiveFrame), ON(outOfEnergy), REJECT},
+	// MAC_STATE_TRY_TX
+	{ON(nodeStartup), REJECT, REJECT, ON_MSG(handleNetworkLayerFrame), ON_MSG(pushFrameIntoBuffer), REJECT, ON(performCarrierSense), REJECT, REJECT, ON(unexpectedTxBufferCheck), REJECT, ON(sleepUntilNextWakeup), ON_MSG(receiveFrame), ON(outOfEnergy), REJECT}
+};
+
+#undef ON
+#undef ON_MSG
+#undef REJECT
 
 /*!
 	\brief Initialises the SpeckMAC module.
 	
-	This method is called when the simulation starts. It loads all the parameters, obtains references to objects of the radio module and the resource manager, determines the CPU clock drift (in order to avoid the nodes remaining synchronised to each other), and disables the module. The MAC algorithm thus starts executing only when a message is received from a higher layer (namely, the network layer).
+	This method is called when the simulation starts. It loads all the parameters, obtains references to objects of the radio module and the resource manager, sets up the local clock of the node from the CPU clock drift (in order to avoid the nodes remaining synchronised to each other), and disables the module. The MAC algorithm thus starts executing only when a message is received from a higher layer (namely, the network layer).
 */
 void SpeckMacModule::initialize()
 {
-	readIniFileParameters();
-
+#ifdef SPECKMAC_PROFILE
+	memset(eventProfile, 0, sizeof(eventProfile));
+	currentProfile = NULL;
+#endif
+	
 	self = parentModule()->parentModule()->index();
+	
+	readIniFileParameters();
+	unfinishedModules++;
+	
+	const char *traceFile = par("traceFile");
+	binaryTrace = (traceFile[0] != '\0') ? BinaryTraceWriter::acquire(traceFile, par("traceFileSize"), par("traceMemoryMapped")) : NULL;
+	currentEvent = MAC_EVENT_UNKNOWN;
 
-	// get a valid reference to the object of the Radio module so that we can make direct calls to its public methods
-	// instead of using extra messages & message types for tighlty couplped operations.
-	radioModule = check_and_cast<RadioModule*>(gate("toRadioModule")->toGate()->ownerModule());
-	radioDataRate = (double) radioModule->par("dataRate");
-	radioDelayForValidCS = ((double) radioModule->par("delayCSValid"))/1000.0; // parameter given in ms in the omnetpp.ini
+	if (pdesMode)
+	{
+		// The radio and the resource manager may be on another partition: their parameters are given to the MAC, and they are never called.
+		radioModule = NULL;
+		resMgrModule = NULL;
+		radioDataRate = par("radioDataRate");
+		radioDelayForValidCS = ((double) par("radioDelayCSValid"))/1000.0; // given in ms, as for the radio.
+		phyLayerOverhead = par("radioPhyFrameOverhead");
+		localClock.setDrift(1.0 + (double) par("cpuClockDrift")); // drawn for the MAC: it is not the drift drawn by the resource manager.
+		
+		// The copies of the radio's parameters can only be checked against the radio when it is on this partition.
+		cGate *radioGate = gate("toRadioModule");
+		while (radioGate->toGate() != NULL)
+			radioGate = radioGate->toGate();
+		RadioModule *localRadio = dynamic_cast<RadioModule *>(radioGate->ownerModule());
+		if ( (localRadio != NULL) && ( ((double) localRadio->par("dataRate") != radioDataRate) || (((double) localRadio->par("delayCSValid"))/1000.0 != radioDelayForValidCS) || ((int) localRadio->par("phyFrameOverhead") != phyLayerOverhead) ) )
+			opp_error("\n[Mac]:\n radioDataRate, radioDelayCSValid and radioPhyFrameOverhead must be the radio's dataRate, delayCSValid and phyFrameOverhead in pdesMode.");
+	}
+	else
+	{
+		// get a valid reference to the object of the Radio module so that we can make direct calls to its public methods
+		// instead of using extra messages & message types for tighlty couplped operations.
+		radioModule = check_and_cast<RadioModule*>(gate("toRadioModule")->toGate()->ownerModule());
+		radioDataRate = (double) radioModule->par("dataRate");
+		radioDelayForValidCS = ((double) radioModule->par("delayCSValid"))/1000.0; // parameter given in ms in the omnetpp.ini
 
-	phyLayerOverhead = radioModule->par("phyFrameOverhead"); // get the physical layer overhead
+		phyLayerOverhead = radioModule->par("phyFrameOverhead"); // get the physical layer overhead
+		
+		// get a valid reference to the object of the Resources Manager module so that we can make direct calls to its public methods
+		// instead of using extra messages & message types for tighlty couplped operations.
+		cModule *parentParent = parentModule()->parentModule();
+		if(parentParent->findSubmodule("nodeResourceMgr") != -1)
+		{
+			resMgrModule = check_and_cast<ResourceGenericManager*>(parentParent->submodule("nodeResourceMgr"));
+		}
+		else
+		{
+			opp_error("\n[Mac]:\n Error in geting a valid reference to  nodeResourceMgr for direct method calls.");
+		}
+		
+		localClock.setDrift(resMgrModule->getCPUClockDrift());
+		initialEnergy = resMgrModule->par("initialEnergy");
+	}
 	
-	// get a valid reference to the object of the Resources Manager module so that we can make direct calls to its public methods
-	// instead of using extra messages & message types for tighlty couplped operations.
-	cModule *parentParent = parentModule()->parentModule();
-	if(parentParent->findSubmodule("nodeResourceMgr") != -1)
+	if (pdesMode && !energyTierThresholds.empty())
+		opp_error("\n[Mac]:\n Energy tiers poll the resource manager directly, and cannot be used in pdesMode.");
+	energyTier = 0;
+	energySleepScale = advertisedSleepScale = 1.0;
+	nextEnergyCheck = 0.0;
+	baseListenInterval = listenInterval;
+	if (!energyTierThresholds.empty())
 	{
-		resMgrModule = check_and_cast<ResourceGenericManager*>(parentParent->submodule("nodeResourceMgr"));
+		// The listen interval of the last tier must still fit a carrier sense.
+		double shortestListenInterval = baseListenInterval * pow(energyTierListenFactor, (energyTierListenFactor < 1.0) ? (double) energyTierThresholds.size() : 0.0);
+		if ( (energyTierSleepFactor <= 0.0) || (energyTierListenFactor <= 0.0) || (shortestListenInterval < radioDelayForValidCS + CARRIER_SENSE_INTERVAL) )
+			opp_error("\n[Mac]:\n Energy tiers need positive factors, and a listen interval of at least %g s in every tier (%g s in tier %d).", radioDelayForValidCS + CARRIER_SENSE_INTERVAL, shortestListenInterval, (energyTierListenFactor < 1.0) ? (int) energyTierThresholds.size() : 0);
 	}
-	else
+	
+	// The skew of the clock varies with the temperature of the node, which follows a cycle of its own phase.
+	double clockSkewWander = par("clockSkewWander");
+	if (clockSkewWander != 0.0)
+	{
+		double clockSkewWanderPeriod = par("clockSkewWanderPeriod");
+		if ( (clockSkewWanderPeriod == 0.0) || (fabs(clockSkewWander) >= 1.0) )
+			opp_error("\n[Mac]:\n A wandering clock skew needs a non-zero clockSkewWanderPeriod, and a clockSkewWander between -1 and 1 (got %g over %g s).", clockSkewWander, clockSkewWanderPeriod);
+		localClock.setWander(clockSkewWander, clockSkewWanderPeriod, 2.0 * M_PI * jitter(), par("clockSkewUpdateInterval"));
+	}
+	
+	// The busy report of the radio must arrive within the carrier sense interval, and a radio that has just started listening must not be answered for.
+	pdesLookahead = ((radioDelayForValidCS < CARRIER_SENSE_INTERVAL) ? radioDelayForValidCS : CARRIER_SENSE_INTERVAL) / 2.0;
+	if (radioLinkDelay > pdesLookahead)
+		opp_error("\n[Mac]:\n radioLinkDelay (%g s) exceeds the lookahead the carrier sense tolerates (%g s).", radioLinkDelay, pdesLookahead);
+	if (pdesMode)
 	{
-		opp_error("\n[Mac]:\n Error in geting a valid reference to  nodeResourceMgr for direct method calls.");
+		// The modelled radio state and the carrier sense timeout assume the connections have exactly radioLinkDelay.
+		cGate *fromRadio = gate("fromRadioModule");
+		while (fromRadio->fromGate() != NULL)
+			fromRadio = fromRadio->fromGate();
+		double toRadioDelay = connectionDelay(gate("toRadioModule"));
+		double fromRadioDelay = connectionDelay(fromRadio);
+		if ( (toRadioDelay != radioLinkDelay) || (fromRadioDelay != radioLinkDelay) )
+			opp_error("\n[Mac]:\n radioLinkDelay (%g s) differs from the delay of the connections to the radio (%g s) and from it (%g s).", radioLinkDelay, toRadioDelay, fromRadioDelay);
 	}
 	
-	cpuClockDrift = resMgrModule->getCPUClockDrift();
+	modelledRadioState = MAC_2_RADIO_ENTER_SLEEP;
+	carrierSenseValidTime = 0.0;
+	
+	precomputeFrameTimings();
+	
+	backoff = BackoffPolicy::create(par("backoffPolicy"), expectingRxTimeout, par("backoffMaxExponent"));
+	
+	framesSent = copiesSent = framesReceived = duplicatesDropped = 0;
+	acksSent = acksReceived = copiesSaved = 0;
+	overheardDropped = 0;
+	carrierBusyCount = busyWhileTx = busyWhileListening = rxFailed = 0;
+	earlySleeps = 0;
+	deferredWakeups = 0;
+	consecutiveBusyCCAs = 0;
+	pendingPhaseShift = 0.0;
+	rephases = 0;
+	sleepIntervalChanges = 0;
+	idleCycles = 0;
+	framesReceivedAtAdaptation = 0;
+	advertisedSleepInterval = sleepInterval;
+	neighbourSleepInterval = 0.0;
+	trainEndTime = 0.0;
+	aggregatedFrames = 0;
+	clearCCAs = 0;
+	clearCCAsStart = 0.0;
+	bufferFullDrops = oversizedDrops = busyDrops = 0;
+	expiredDrops = bufferFullEvictions = 0;
+	energyTierDrops = 0;
+	shutDownDrops = 0;
+	inlinedHops = 0;
+	inlineDepth = 0;
+	lastSendEvent = -1;
+	radioOnTime = radioSleepTime = 0.0;
+	lastRadioStateChange = simTime();
+	radioOn = false;
+	
+	if (recordVectors)
+	{
+		txBufferVector.setName("TX buffer occupancy");
+		carrierSenseVector.setName("carrier busy");
+		sleepIntervalVector.setName("sleep interval");
+	}
 	
 	// Set radio to sleep
 	setRadioState(MAC_2_RADIO_ENTER_SLEEP);
 	
 	macState = MAC_STATE_DEFAULT;
 	
-	schedTXBuffer = new MAC_GenericFrame*[MAC_BUFFER_ARRAY_SIZE];
+	for (int from = 0; from < MAC_STATE_COUNT; from++)
+		for (int to = 0; to < MAC_STATE_COUNT; to++)
+			transitionCounts[from][to] = 0;
+	rejectedEvents = 0;
 	
-	headTxBuffer = 0;
-	tailTxBuffer = 0;
+	schedTXBuffer.setCapacity(queuePriorityLevels, macBufferSize);
+	rxSeqCache.setSize(seqCacheSize);
+	nextSeqNum = 0;
 	
-	// Statistics
-#ifdef STATISTICS
-	numRecd = 0;
-	numSent = 0;
-#endif
 	// maxSchedTXBufferSizeRecorded = 0;
 
 	epsilon = 0.000001f;
 
 	disabled = TRUE;
+	shutDown = false;
+	shutDownTime = 0.0;
+	restored = false;
 	
-	dutyCycleSleepMsg = NULL;
-	dutyCycleWakeupMsg = NULL;
+	// Self-messages are allocated once, and rescheduled for the rest of the simulation.
+	dutyCycleSleepMsg = new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP);
+	dutyCycleWakeupMsg = new MAC_ControlMessage("wake_up_radio", MAC_SELF_WAKEUP_RADIO);
+	performCSMsg = new MAC_ControlMessage("Enter carrier sense state MAC->MAC", MAC_SELF_PERFORM_CARRIER_SENSE);
+	selfExitCSMsg = new MAC_ControlMessage("Exit carrier sense state MAC->MAC", MAC_SELF_EXIT_CARRIER_SENSE);
+	checkTxBufferMsg = new MAC_ControlMessage("check schedTXBuffer buffer", MAC_SELF_CHECK_TX_BUFFER);
+	initiateTxMsg = new MAC_ControlMessage("initiate a TX", MAC_SELF_INITIATE_TX);
+	ackTimeoutMsg = new MAC_ControlMessage("early ack timeout MAC->MAC", SPECKMAC_SELF_ACK_TIMEOUT);
 	
 	CASTALIA_DEBUG << "\nSpeckMAC_"<<self<<"[t = "<< simTime() << "]: Initialization complete";
 	
 	doTx = FALSE;
+	
+	trainFrame = NULL;
+	trainCopiesSent = 0;
+	trainAwaitsAck = false;
+	
+	if (!restoreFile.empty())
+		restoreCheckpoint(restoreFile.c_str());
 }
 
 /*!
 	\brief Clean-up method executed before the simulation stops.
 	
-	This method is called when the simulation stops executing. It clears the transmission buffer, deallocates memory, and (optional) prints statistics collected by the MAC layer. To disable the last, comment the #define STATISTICS line.
+	This method is called when the simulation stops executing. If checkpointFile is set, it first saves the state of the module (see saveCheckpoint()). It then clears the transmission buffer, deletes the persistent self-messages, deallocates memory, and records the performance counters, the state transitions taken (one scalar per pair of states, for the pairs that occurred) and the number of rejected events as scalars.
  */
 void SpeckMacModule::finish()
 {
-	MAC_GenericFrame *macMsg;
+	SpeckMacFrame *macMsg;
+	
+	accountRadioTime(simTime()); // commands that have not taken effect by now never will.
 	
-	while(!BUFFER_IS_EMPTY)
+	if (!checkpointFile.empty())
+		saveCheckpoint(checkpointFile.c_str());
+	
+	while(!schedTXBuffer.empty())
 	{
-		macMsg = popTxBuffer();
+		macMsg = schedTXBuffer.pop();
 
 		cancelAndDelete(macMsg);
 
 		macMsg = NULL;
 	}
 	
-#ifdef STATISTICS
-	EV << numRecd << "," << numSent << "\t";
+	delete trainFrame;
+	trainFrame = NULL;
+	
+	delete backoff;
+	backoff = NULL;
+	
+	if (binaryTrace != NULL)
+		binaryTrace->release(); // the last node closes the trace.
+	binaryTrace = NULL;
+	
+	cancelAndDelete(dutyCycleSleepMsg);
+	cancelAndDelete(dutyCycleWakeupMsg);
+	cancelAndDelete(performCSMsg);
+	cancelAndDelete(selfExitCSMsg);
+	cancelAndDelete(checkTxBufferMsg);
+	cancelAndDelete(initiateTxMsg);
+	cancelAndDelete(ackTimeoutMsg);
+	dutyCycleSleepMsg = dutyCycleWakeupMsg = performCSMsg = selfExitCSMsg = checkTxBufferMsg = initiateTxMsg = ackTimeoutMsg = NULL;
+	
+	char scalarName[80];
+	for (int from = 0; from < MAC_STATE_COUNT; from++)
+	{
+		for (int to = 0; to < MAC_STATE_COUNT; to++)
+		{
+			if (transitionCounts[from][to] > 0)
+			{
+				sprintf(scalarName, "transitions %s->%s", macStateNames[from], macStateNames[to]);
+				recordScalar(scalarName, transitionCounts[from][to]);
+			}
+		}
+	}
+	recordScalar("rejected events", rejectedEvents);
+	
+	recordScalar("frames sent", framesSent);
+	recordScalar("redundant copies sent", copiesSent);
+	recordScalar("frames received", framesReceived);
+	recordScalar("duplicates dropped", duplicatesDropped);
+	recordScalar("overheard frames dropped", overheardDropped);
+	recordScalar("early acks sent", acksSent);
+	recordScalar("early acks received", acksReceived);
+	recordScalar("copies saved by early acks", copiesSaved);
+	recordScalar("carrier busy", carrierBusyCount);
+	recordScalar("carrier busy while TX", busyWhileTx);
+	recordScalar("carrier busy while listening", busyWhileListening);
+	recordScalar("Rx failed", rxFailed);
+	recordScalar("early sleeps", earlySleeps);
+	recordScalar("deferred wakeups", deferredWakeups);
+	recordScalar("duty cycle rephases", rephases);
+	recordScalar("sleep interval changes", sleepIntervalChanges);
+	recordScalar("final sleep interval", sleepInterval);
+	recordScalar("aggregated frames", aggregatedFrames);
+	recordScalar("buffer full drops", bufferFullDrops);
+	recordScalar("oversized drops", oversizedDrops);
+	recordScalar("carrier busy drops", busyDrops);
+	recordScalar("expired drops", expiredDrops);
+	recordScalar("inlined zero-delay hops", inlinedHops);
+	recordScalar("buffer full evictions", bufferFullEvictions);
+	if (!energyTierThresholds.empty())
+	{
+		recordScalar("energy tier drops", energyTierDrops);
+		recordScalar("final energy tier", energyTier);
+		for (unsigned int tier = 1; tier <= energyTierEntryTimes.size(); tier++)
+		{
+			sprintf(scalarName, "energy tier %d entered", tier);
+			recordScalar(scalarName, energyTierEntryTimes[tier - 1]);
+		}
+	}
+	if (shutDown)
+	{
+		recordScalar("out of energy time", shutDownTime);
+		recordScalar("frames lost at shutdown", shutDownDrops);
+	}
+	recordScalar("final clock skew", localClock.currentSkew());
+	recordScalar("radio on time", radioOnTime);
+	recordScalar("radio sleep time", radioSleepTime);
+	if (pdesMode)
+		recordScalar("PDES lookahead", pdesLookahead);
+	
+	// The pools are shared by all the nodes of the process; their counters are recorded once, by the last node to finish, and the next run starts with empty pools.
+	if (--unfinishedModules == 0)
+	{
+		recordScalar("control message pool hits", FreeListPool<SpeckMacControlMessage>::hits());
+		recordScalar("control message pool misses", FreeListPool<SpeckMacControlMessage>::misses());
+		recordScalar("frame pool hits", FreeListPool<SpeckMacFrame>::hits());
+		recordScalar("frame pool misses", FreeListPool<SpeckMacFrame>::misses());
+		FreeListPool<SpeckMacControlMessage>::clear();
+		FreeListPool<SpeckMacFrame>::clear();
+	}
+	
+#ifdef SPECKMAC_PROFILE
+	recordProfile();
 #endif
 }
 
@@ -105,6 +423,8 @@ void SpeckMacModule::finish()
 
 	The received message is passed to this method as an argument.
 	
+	The kind of the message is mapped to an event (see eventOf()), and the handler of the event in the current state is looked up in transitionTable. Events that have no handler in the current state are rejected, and counted.
+	
 	The method handles the following kinds of messages:
 	\par (a) APP_NODE_STARTUP: 
 	This message is received from the network module to start the MAC module up. When this message is received, the module is enabled, and radio duty cycling is initialised.
@@ -135,349 +455,567 @@ void SpeckMacModule::finish()
 	\par (n) RESOURCE_MANAGER_OUT_OF_ENERGY
 	This message is sent by the resource manager module to the MAC module when the node rns out of battery. Disable node when this occurs.
 
+	\note The persistent self-messages (see initialize()) are owned by the module for the whole simulation, and are never deleted here. Frames from the network layer are handed over to the transmission buffer without being copied. All other messages are deleted once handled.
+	\note With SPECKMAC_PROFILE, the time spent handling each event, and the messages scheduled or sent meanwhile, are accounted to the event (see recordProfile()).
+
 	\param msg
 	This parameter contains the message received by the MAC module.
  */
 void SpeckMacModule::handleMessage (cMessage *msg)
+{
+#ifdef SPECKMAC_PROFILE
+	int profiledEvent = isDroppedWhileDisabled(msg->kind()) ? MAC_EVENT_UNKNOWN : eventOf(msg->kind());
+	EventProfile *callerProfile = currentProfile; // not NULL for a hop handled inline.
+	currentProfile = &eventProfile[profiledEvent];
+	double handlerStart = profileClock();
+	
+	handleEvent(msg);
+	
+	currentProfile->handlerTime += profileClock() - handlerStart;
+	currentProfile->count++;
+	currentProfile = callerProfile;
+#else
+	handleEvent(msg);
+#endif
+}
+
+/*!
+	\brief Dispatch a message to the handler of its event in the current state; see handleMessage().
+*/
+void SpeckMacModule::handleEvent(cMessage *msg)
 {
 	int msgKind = msg->kind();
 	
-	if ((disabled == TRUE) && (msgKind != APP_NODE_STARTUP))
+	if (isDroppedWhileDisabled(msgKind))
 	{
-		delete msg;
+		if (!isPersistentSelfMessage(msg))
+			delete msg;
 		msg = NULL;
 		return;
 	}
 	
-	switch (msgKind)
-	{
-		case APP_NODE_STARTUP:
-		{
-			disabled = FALSE; // enable the Node's MAC layer.
-				
-			dutyCycleWakeupMsg = new MAC_ControlMessage("wake_up_radio", MAC_SELF_WAKEUP_RADIO);
-			scheduleAt(simTime(), dutyCycleWakeupMsg); // Switch to wake up mode  now. Sleep automatically scheduled.
-			
-			break;
-		}
-		
-		case MAC_SELF_SET_RADIO_SLEEP:
-		{
-			dutyCycle(SLEEP);
-			break;
-		}
-		
-		case MAC_SELF_WAKEUP_RADIO:
-		{
-			dutyCycle(WAKEUP);
-			break;
-		}
-		
-		case NET_FRAME:
-		{
-			handleNetworkLayerFrame(msg);
-			break;
-		}
-		
-		case MAC_FRAME_SELF_PUSH_TX_BUFFER:
-		{
-			pushFrameIntoBuffer(msg);
-			break;
-		}
-		
-		case MAC_SELF_INITIATE_TX:
-		{
-			// disable duty cycling, start radio up.
-			if (macState == MAC_STATE_DEFAULT)
-			{
-				macState = MAC_STATE_TRY_TX;
-				if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-				{
-					cancelAndDelete(dutyCycleWakeupMsg);
-					dutyCycleWakeupMsg = NULL;
-				}
-				if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-				{
-					cancelAndDelete(dutyCycleSleepMsg);
-					dutyCycleSleepMsg = NULL;
-				}
-				
-				// set radio to listen.
-				setRadioState(MAC_2_RADIO_ENTER_LISTEN, 0.001 * dblrand());
-				
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<< self << "] t=" << simTime() << ": Init TX;  Mac State=" << macState;
-				initiateCarrierSense();
-			}
-			
-			break;
-		}
-		
-		case MAC_SELF_PERFORM_CARRIER_SENSE:
-		{
-			performCarrierSense();
-			// If carrier is free, MAC_SELF_EXIT_CARRIER_SENSE happens. if not, RADIO_2_MAC_CARRIER_SENSED occurs.
-			break;
-		}
-		
-		// Carrier busy
-		case RADIO_2_MAC_SENSED_CARRIER:
-		{
-			carrierBusy();
-			break;
-		}
-		
-		// Carrier free.
-		case MAC_SELF_EXIT_CARRIER_SENSE:
-		{
-			carrierFree();
-			break;
-		}
-		
-		case MAC_SELF_CHECK_TX_BUFFER:
-		{
-			sendData();
-			break;
-		}
-		
-		case RADIO_2_MAC_STARTED_TX:
-		{	
-			if(macState == MAC_STATE_CARRIER_SENSING)
-			{
-				macState = MAC_STATE_DEFAULT;
-				if(printStateTransitions)
-				{
-					CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_DEFAULT (RADIO_2_MAC_STARTED_TX received when MAC_STATE_CARRIER_SENSING)";
-				}
-
-				scheduleAt(simTime(), new MAC_ControlMessage("check schedTXBuffer buffer", MAC_SELF_CHECK_TX_BUFFER));
-			}
-			else if(macState == MAC_STATE_DEFAULT)
-			{
-				CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << "; Start TX";
-				macState = MAC_STATE_TX;
-				if(printStateTransitions)
-				{
-					CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_TX (RADIO_2_MAC_STARTED_TX received when MAC_STATE_DEFAULT)";
-				}
-			}
-			break;
-		}
+	int event = eventOf(msgKind);
 	
-		case RADIO_2_MAC_STOPPED_TX:
-		{
-			finishDataTransmission();
-			break;
-		}
+	if (event == MAC_EVENT_STOPPED_TX)
+		modelRadioStoppedTx();
+	
+	if (event != MAC_EVENT_UNKNOWN)
+	{
+		MacEventHandler handler = transitionTable[macState][event];
 		
-		// packet received from radio.
-		case MAC_FRAME:
+		if (handler != NULL)
 		{
-			MAC_GenericFrame *rcvFrame;
-			rcvFrame = check_and_cast<MAC_GenericFrame*>(msg);
-#ifdef STATISTICS
-			numRecd ++;
-#endif	
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Rx Pkt";
-			
-			macState = MAC_STATE_DEFAULT;
-			
-			// Cancel currently scheduled sleep
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-			}
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-			}
-			
-			// Sleep now.
-			dutyCycleSleepMsg = new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP);
-			scheduleAt(simTime(), dutyCycleSleepMsg); 	
-#ifdef DEBUG
-			if ( (self == 6) || (self == 5) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep now"; 
-#endif	
-			int destinationID = rcvFrame->getHeader().destID;
-				
-			Network_GenericFrame *netDataFrame; // No need to create a new message because of the decapsulation: netDataFrame = new Network_GenericFrame("Network frame MAC->Network", NET_FRAME);
-	
-			// decaspulate the received MAC frame and create a valid Network_GenericFrame
-			netDataFrame = check_and_cast<Network_GenericFrame *>(rcvFrame->decapsulate());
-	
-			// Send the App_GenericDataPacket message to the Application module
-			send(netDataFrame, "toNetworkModule");
+			int callerEvent = currentEvent; // not MAC_EVENT_UNKNOWN for a hop handled inline.
+			currentEvent = event;
+			(this->*handler)(msg);
+			currentEvent = callerEvent;
 			
-			break;
+			if (macEventInfo[event].takesOwnership)
+				msg = NULL; // The handler now owns the message, or has deleted it.
 		}
-		
-		case RESOURCE_MGR_OUT_OF_ENERGY:
+		else
 		{
-			disabled = 1;
-			break;
+			rejectedEvents++;
+			CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": " << macEventInfo[event].name << " rejected in " << macStateNames[macState];
 		}
-			
-	} // end of switch case.
+	}
 	
-	delete msg;
+	if (!isPersistentSelfMessage(msg))
+		delete msg;
 	msg = NULL;
 }
 
+#ifdef SPECKMAC_PROFILE
 /*!
-	\brief Performs duty cycling.
-	
-	This method schedule duty cycling. Every sleepInterval seconds, it switches on and schedules a wakeup message after listenInterval seconds, and vice versa. 
+	\brief Read a monotonic clock, in seconds.
+*/
+double SpeckMacModule::profileClock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
 
-	\param typeID
-	This parameter takes two values, SLEEP or WAKEUP, which specifies whether the radio is switched on, or put to sleep mode.
- */
-void SpeckMacModule::dutyCycle(int typeID)
+/*!
+	\brief Record the profile of every event that occurred as scalars (SPECKMAC_PROFILE).
+	
+	For each event: the number of messages handled, the handler time (in seconds), the number of messages scheduled or sent by the handler, and how many of those were self-messages for the current time. The last two show the events inflated by zero-delay self-message chains. The number of messages handled inline (inlineZeroDelayHops) is also recorded; the handler time of such a hop is included in the time of the handler that made it, too.
+*/
+void SpeckMacModule::recordProfile()
 {
-	if (typeID == SLEEP)
-	{	
-		if (macState == MAC_STATE_EXPECTING_RX)
-		{
-			if ( (self == 6) || (self == 5) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Rx failed.";
-			macState = MAC_STATE_DEFAULT;
-		}
+	char scalarName[100];
+	for (int event = 0; event <= MAC_EVENT_UNKNOWN; event++)
+	{
+		const EventProfile &profile = eventProfile[event];
+		const char *eventName = (event < MAC_EVENT_COUNT) ? macEventInfo[event].name : "UNKNOWN";
 		
-		if (macState == MAC_STATE_DEFAULT) // if its not txing, expecting an rx, or carrier sensing
-		{
-#ifdef DEBUG
-			if ( (self == 6) || (self == 5) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Radio sleep.";
-#endif
-			
-			setRadioState(MAC_2_RADIO_ENTER_SLEEP); // switch to sleep mode.
-				
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-			}
-			
-			dutyCycleWakeupMsg = new MAC_ControlMessage("wake_up_radio", MAC_SELF_WAKEUP_RADIO);
-	
-			scheduleAt(simTime() + DRIFTED_TIME(sleepInterval), dutyCycleWakeupMsg);
-		}
-		else
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Radio sleep FAILED.";
-		}
-		dutyCycleSleepMsg = NULL;
+		if (profile.count == 0)
+			continue;
+		
+		sprintf(scalarName, "profile %s count", eventName);
+		recordScalar(scalarName, profile.count);
+		sprintf(scalarName, "profile %s handler time", eventName);
+		recordScalar(scalarName, profile.handlerTime);
+		sprintf(scalarName, "profile %s messages spawned", eventName);
+		recordScalar(scalarName, profile.spawned);
+		sprintf(scalarName, "profile %s zero-delay self-messages", eventName);
+		recordScalar(scalarName, profile.zeroDelaySelf);
+		sprintf(scalarName, "profile %s handled inline", eventName);
+		recordScalar(scalarName, profile.inlined);
 	}
-	else if (typeID == WAKEUP)
-	{		
-#ifdef DEBUG
-		if ( (self == 6) || (self == 5) )
-			CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"]t = "<< simTime() << ": Radio wakeup";
+}
 #endif
-		
-		if (macState == MAC_STATE_DEFAULT)
-		{
-			setRadioState(MAC_2_RADIO_ENTER_LISTEN);
-			
-			lastWakeupTime = simTime(); // This is the time the node wakes up.
-			
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-			}
-			
-			dutyCycleSleepMsg = new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP);
-			scheduleAt(simTime() + DRIFTED_TIME(listenInterval), dutyCycleSleepMsg); // Get radio to go to sleep
-			
-			initiateCarrierSense();
-		}
-		else
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Radio wakeup FAILED.";
-		}
-		
-		dutyCycleWakeupMsg = NULL;
+
+/*!
+	\brief Map a message kind to a SpeckMAC-D event.
+	
+	\return The event, or MAC_EVENT_UNKNOWN if the module does not handle messages of this kind.
+*/
+int SpeckMacModule::eventOf(int msgKind)
+{
+	switch (msgKind)
+	{
+		case APP_NODE_STARTUP: return MAC_EVENT_NODE_STARTUP;
+		case MAC_SELF_SET_RADIO_SLEEP: return MAC_EVENT_SLEEP;
+		case MAC_SELF_WAKEUP_RADIO: return MAC_EVENT_WAKEUP;
+		case NET_FRAME: return MAC_EVENT_NET_FRAME;
+		case MAC_FRAME_SELF_PUSH_TX_BUFFER: return MAC_EVENT_PUSH_TX_BUFFER;
+		case MAC_SELF_INITIATE_TX: return MAC_EVENT_INITIATE_TX;
+		case MAC_SELF_PERFORM_CARRIER_SENSE: return MAC_EVENT_PERFORM_CARRIER_SENSE;
+		case RADIO_2_MAC_SENSED_CARRIER: return MAC_EVENT_CARRIER_BUSY;
+		case MAC_SELF_EXIT_CARRIER_SENSE: return MAC_EVENT_CARRIER_FREE;
+		case MAC_SELF_CHECK_TX_BUFFER: return MAC_EVENT_CHECK_TX_BUFFER;
+		case RADIO_2_MAC_STARTED_TX: return MAC_EVENT_STARTED_TX;
+		case RADIO_2_MAC_STOPPED_TX: return MAC_EVENT_STOPPED_TX;
+		case MAC_FRAME: return MAC_EVENT_FRAME_RECEIVED;
+		case RESOURCE_MGR_OUT_OF_ENERGY: return MAC_EVENT_OUT_OF_ENERGY;
+		case SPECKMAC_SELF_ACK_TIMEOUT: return MAC_EVENT_ACK_TIMEOUT;
+		default: return MAC_EVENT_UNKNOWN;
 	}
 }
 
 /*!
-	\brief Handles network layer packets received from the Network module.
+	\brief Change the state of the MAC layer.
 	
-	This method is executed whenever the MAC module receives a network layer frame (case NET_FRAME). It encapsulates the network layer packet into a MAC layer frame, sets the \b{doTx} flag to indicate that the module has to transmit the packet to the radio, and schedules a message that pushes the frame into the transmission buffer. It then schedules, after a random offset period which may be defined in the ini file, the initiation of transmission to the radio layer.
+	All state changes go through this method, which counts the transitions (recorded as scalars in finish()) and prints them out if printStateTransitions is set.
 	
-	\param msg
-	This parameter holds the network layer packet received.
+	\param newState
+	The new state.
+	\param reason
+	The reason for the state change, to be printed out.
 */
-void SpeckMacModule::handleNetworkLayerFrame(cMessage *msg)
+void SpeckMacModule::setMacState(int newState, const char *reason)
 {
-	if (!BUFFER_IS_FULL)
-	{
-		Network_GenericFrame *rcvNetDataFrame = check_and_cast<Network_GenericFrame*>(msg);
-		// Create the MACFrame from the Network Data Packet (encapsulation)	
-		MAC_GenericFrame *dataFrame;
-		
-		char buff[50];
+	transitionCounts[macState][newState]++;
 	
-		sprintf(buff, "MAC Data frame (%f)", simTime());
-		dataFrame = new MAC_GenericFrame(buff, MAC_FRAME);
-		
-		if(encapsulateNetworkFrame(rcvNetDataFrame, dataFrame))
-		{
-			doTx = TRUE; // indicate that tx has to be performed. This is because both Tx and Rx use Carrier sense.
-			
-			dataFrame->setKind(MAC_FRAME_SELF_PUSH_TX_BUFFER); // the dataFrame is a pointer of type MAC_GenericFrame*
-			scheduleAt(simTime(), dataFrame);
-			// (int) ((sleepInterval * radioDataRate * 1000) / ((rcvNetDataFrame->byteLength() + macFrameOverhead) * 8) );
-			//pushFrameIntoBuffer(msg);
-			
-			scheduleAt(simTime() + DRIFTED_TIME(dblrand() * randomTxOffset), new MAC_ControlMessage("initiate a TX", MAC_SELF_INITIATE_TX));
-		}
-		else
-		{
-			cancelAndDelete(dataFrame);
-			dataFrame = NULL;
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": WARNING: Network module sent to MAC an oversized packet...packet dropped!!\n";
-		}
-		
-		rcvNetDataFrame = NULL;
-		dataFrame = NULL;
+	if (binaryTrace != NULL)
+		binaryTrace->record(simTime(), simulation.eventNumber(), self, macState, newState, currentEvent, schedTXBuffer.size());
+	
+	if(printStateTransitions)
+	{
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed from " << macStateNames[macState] << " to " << macStateNames[newState] << " (" << reason << ")";
 	}
 	
+	macState = newState;
 }
 
 /*!
-	\brief Initiates carrier sense.
+	\brief Start the MAC module up (APP_NODE_STARTUP).
 	
-	SpeckMAC performs carrier sense under two circumstances: (a) if the node is checking for packets in the medium, and (b) if the node requires to transmit, and needs to perform a Clear Channel Assessment (CCA) a priori. It schedules a MAC_SELF_PERFORM_CARRIER_SENSE message.
- */
-void SpeckMacModule::initiateCarrierSense()
+	The module is enabled, and radio duty cycling is initialised.
+*/
+void SpeckMacModule::nodeStartup()
 {
-	// there is no point to do the following things when the Mac is already in TX mode and moreover if it is in MAC_STATE_EXPECTING_RX
-	if ( (macState == MAC_STATE_DEFAULT) || (macState == MAC_STATE_TRY_TX) )
-	{	
-		if ( ((doTx == TRUE) && !(BUFFER_IS_EMPTY)) || (doTx == FALSE) ) // either packet to be transmitted, and buffer not empty, or no packet to  be transmitted, perform carrier sense
-		{
-			
-			scheduleAt(simTime(), new MAC_ControlMessage("Enter carrier sense state MAC->MAC", MAC_SELF_PERFORM_CARRIER_SENSE));
-			// perform carrier sense NOW!
-#ifdef DEBUG
-			if ( (self == 6) || (self == 5) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << " Perform Carrier Sense.";
-#endif
-		}							  
-		else if ( (doTx == TRUE) && (BUFFER_IS_EMPTY) )
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": WARNING: MAC_SELF_INITIATE_TX received but Mac Buffer is empty.\n";
+	// The duty cycle of a restored node carries on with the phase it had when the checkpoint was saved.
+	if (restored && (disabled == FALSE))
+	{
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": APP_NODE_STARTUP ignored, the state was restored from a checkpoint";
+		return;
+	}
+	
+	disabled = FALSE; // enable the Node's MAC layer.
+	
+	// Nodes started at the same time would otherwise share the phase of their duty cycles.
+	double phaseOffset = startupPhaseJitter ? localToSim(jitter() * (listenInterval + sleepInterval)) : 0.0;
+		
+	// Switch to wake up mode  now (or after the phase offset). Sleep automatically scheduled.
+	if (phaseOffset > 0.0)
+		rescheduleSelfMessage(dutyCycleWakeupMsg, phaseOffset);
+	else
+		postSelfMessage(dutyCycleWakeupMsg);
+}
+
+/*!
+	\brief Draw a uniform random number in [0, 1) from the module's random number stream (rngStream).
+	
+	All the random offsets (transmission offset, listen delay, duty cycle phase, back-off) are drawn here, so that each module's jitter can be given a stream of its own, independent of the other modules.
+*/
+double SpeckMacModule::jitter()
+{
+	return genk_dblrand(rngStream);
+}
+
+/*!
+	\brief Initiate a transmission (MAC_SELF_INITIATE_TX in MAC_STATE_DEFAULT).
+	
+	Duty cycling is disabled, the radio is switched on, and a carrier sense is initiated.
+*/
+void SpeckMacModule::initiateTransmission()
+{
+	if (deferToTrainEnd(initiateTxMsg))
+		return;
+	
+	// disable duty cycling, start radio up.
+	setMacState(MAC_STATE_TRY_TX, "MAC_SELF_INITIATE_TX received when MAC_STATE_DEFAULT");
+	cancelSelfMessage(dutyCycleWakeupMsg);
+	cancelSelfMessage(dutyCycleSleepMsg);
+	
+	// set radio to listen.
+	setRadioState(MAC_2_RADIO_ENTER_LISTEN, localToSim(0.001 * jitter()));
+	
+	CASTALIA_DEBUG << "\n[SpeckMAC_"<< self << "] t=" << simTime() << ": Init TX;  Mac State=" << macState;
+	initiateCarrierSense();
+}
 
-			macState = MAC_STATE_DEFAULT;
-			if(printStateTransitions)
+/*!
+	\brief Defer a wakeup or a transmission that falls inside a redundant train heard by the node.
+	
+	The channel is busy until trainEndTime, so a carrier sense before then would only find it busy, and keep the radio on in MAC_STATE_EXPECTING_RX for the frame already received.
+	
+	\param msg
+	The self-message being handled; it is rescheduled for trainEndTime.
+	\return true if the message was deferred, and must not be handled now.
+*/
+bool SpeckMacModule::deferToTrainEnd(cMessage *msg)
+{
+	if (simTime() >= trainEndTime)
+		return false;
+	
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": " << msg->name() << " deferred to the end of the train at " << trainEndTime;
+	deferredWakeups++;
+	rescheduleSelfMessage(msg, trainEndTime - simTime());
+	return true;
+}
+
+/*!
+	\brief The radio started transmitting while the MAC was carrier sensing (RADIO_2_MAC_STARTED_TX in MAC_STATE_CARRIER_SENSING).
+*/
+void SpeckMacModule::txStartedWhileSensing()
+{
+	setMacState(MAC_STATE_DEFAULT, "RADIO_2_MAC_STARTED_TX received when MAC_STATE_CARRIER_SENSING");
+	
+	postSelfMessage(checkTxBufferMsg);
+}
+
+/*!
+	\brief The radio started transmitting (RADIO_2_MAC_STARTED_TX in MAC_STATE_DEFAULT).
+*/
+void SpeckMacModule::txStarted()
+{
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << "; Start TX";
+	setMacState(MAC_STATE_TX, "RADIO_2_MAC_STARTED_TX received when MAC_STATE_DEFAULT");
+}
+
+/*!
+	\brief Handle a frame received from the radio (MAC_FRAME).
+	
+	The copy carries its index in the redundant train, the length of the train, and the gap the sender leaves between copies: the node records when the train ends, and its wakeups and transmissions until then are deferred (see deferToTrainEnd()).
+	Unless promiscuous is set, a unicast frame addressed to another node is dropped without being decapsulated.
+	The destination of a unicast frame sends an early ack if unicastEarlyAck is set and the train is not over (see sendAck()); early acks are handled by receiveAck().
+	The node goes to sleep immediately, and the network frames carried by the MAC frame are sent to the network layer. A frame carrying the same sequence number as the last frame received from its source is another copy of that frame; it is dropped before it is decapsulated (see SequenceCache).
+*/
+void SpeckMacModule::receiveFrame(cMessage *msg)
+{
+	SpeckMacFrame *rcvFrame;
+	rcvFrame = check_and_cast<SpeckMacFrame*>(msg);
+	
+	if (rcvFrame->getHeader().frameType == SPECKMAC_ACK_FRAME)
+	{
+		receiveAck(rcvFrame);
+		return;
+	}
+	
+	// Each of the remaining copies takes as long to send as this one, and follows the previous one after the sender's gap.
+	int frameLength = rcvFrame->byteLength();
+	if (frameLength > maxMacFrameSize)
+		frameLength = maxMacFrameSize;
+	double rcvTrainEndTime = simTime() + localToSim(rcvFrame->copiesRemaining() * (rcvFrame->getCopyGap() + txTimeByLength[frameLength]));
+	if (rcvTrainEndTime > trainEndTime)
+		trainEndTime = rcvTrainEndTime;
+	
+	// The sender will expect this node to wake up at least as often as it does, and the trains of this node must cover the sender's sleep.
+	double senderSleepInterval = rcvFrame->getSleepInterval();
+	if ( (adaptiveDutyCycle || !energyTierThresholds.empty()) && (senderSleepInterval > 0.0) )
+	{
+		if (adaptiveDutyCycle && (senderSleepInterval < sleepInterval))
+			setSleepInterval(senderSleepInterval, "advertised by neighbour");
+		if (senderSleepInterval > neighbourSleepInterval)
+		{
+			neighbourSleepInterval = senderSleepInterval;
+			if (neighbourSleepInterval > trainCoverInterval)
 			{
-				CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_DEFAULT (MAC_SELF_INITIATE_TX received and buffer is empty)";
+				trainCoverInterval = neighbourSleepInterval;
+				precomputeRedundancies();
 			}
+		}
+	}
+	
+	// Unicast frames for other nodes, and the other copies of a frame received earlier, are dropped before they are decapsulated.
+	int destinationID = rcvFrame->getHeader().destID;
+	bool isOverheard = !promiscuous && (destinationID != self) && (destinationID != BROADCAST_ADDR);
+	bool isDuplicate = !isOverheard && rxSeqCache.isDuplicate(rcvFrame->getHeader().srcID, rcvFrame->getSeqNum());
+	if (isOverheard)
+	{
+		overheardDropped++;
+		SPECKMAC_TRACE << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Rx Pkt for " << destinationID << " dropped";
+	}
+	else if (isDuplicate)
+	{
+		duplicatesDropped++;
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Rx duplicate Pkt " << rcvFrame->getSeqNum() << " from " << rcvFrame->getHeader().srcID;
+	}
+	else
+	{
+		framesReceived++;
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Rx Pkt";
+	}
+	
+	if (trainFrame != NULL)
+	{
+		// The frame was heard while listening for an early ack; it is delivered, and the train carries on.
+	}
+	else if (unicastEarlyAck && (rcvFrame->getHeader().destID == self) && (rcvFrame->copiesRemaining() > 0))
+	{
+		setMacState(MAC_STATE_DEFAULT, "MAC_FRAME received");
+		
+		// The node sleeps once the ack has been sent (see finishDataTransmission()).
+		sendAck(rcvFrame);
+	}
+	else
+	{
+		setMacState(MAC_STATE_DEFAULT, "MAC_FRAME received");
+		
+		// Cancel currently scheduled wakeup, and sleep now.
+		cancelSelfMessage(dutyCycleWakeupMsg);
+		rescheduleSelfMessage(dutyCycleSleepMsg);
+		SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep now"; 
+	}
+	
+	if (isOverheard || isDuplicate)
+		return;
+		
+	vector<Network_GenericFrame *> netDataFrames; // No need to create a new message because of the decapsulation: netDataFrame = new Network_GenericFrame("Network frame MAC->Network", NET_FRAME);
+
+	// detach the shared payload of the received MAC frame. It is copied only if other copies of the frame still exist. An aggregated frame carries several network frames.
+	rcvFrame->detachPayload(netDataFrames);
+	
+	for (unsigned int i = 0; i < netDataFrames.size(); i++)
+	{
+		take(netDataFrames[i]);
+
+		// Send the App_GenericDataPacket message to the Application module
+		send(netDataFrames[i], "toNetworkModule");
+	}
+}
+
+/*!
+	\brief Shut the node down when it runs out of energy (RESOURCE_MGR_OUT_OF_ENERGY).
+	
+	The module is disabled for good: every persistent self-message is cancelled, the frames waiting to be sent are discarded, and the radio is put to sleep, so that it no longer delivers frames from the channel. The sleep command takes effect after the radio commands still pending (e.g. those of a train being sent), which would otherwise wake the radio up again. The module then generates no event of its own. Messages still delivered to it (frames from the network layer, and the events already in flight) are deleted unhandled, without allocating anything; APP_NODE_STARTUP no longer enables it.
+	The other modules of the node are informed by the resource manager itself.
+*/
+void SpeckMacModule::outOfEnergy()
+{
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": out of energy, shutting down with " << schedTXBuffer.size() << " frames queued";
+	
+	disabled = TRUE;
+	shutDown = true;
+	shutDownTime = simTime();
+	
+	cancelSelfMessage(dutyCycleSleepMsg);
+	cancelSelfMessage(dutyCycleWakeupMsg);
+	cancelSelfMessage(performCSMsg);
+	cancelSelfMessage(selfExitCSMsg);
+	cancelSelfMessage(checkTxBufferMsg);
+	cancelSelfMessage(initiateTxMsg);
+	cancelSelfMessage(ackTimeoutMsg);
+	
+	while (!schedTXBuffer.empty())
+	{
+		delete schedTXBuffer.pop();
+		shutDownDrops++;
+	}
+	delete trainFrame;
+	trainFrame = NULL;
+	doTx = FALSE;
+	
+	if (macState != MAC_STATE_DEFAULT)
+		setMacState(MAC_STATE_DEFAULT, "RESOURCE_MGR_OUT_OF_ENERGY received");
+	
+	double sleepDelay = 0.0;
+	if (!radioCommandsToAccount.empty() && (radioCommandsToAccount.backTime() > simTime()))
+		sleepDelay = radioCommandsToAccount.backTime() - simTime() + epsilon;
+	setRadioState(MAC_2_RADIO_ENTER_SLEEP, sleepDelay);
+}
+
+/*!
+	\brief Handler for events that are expected in a state, but require no action.
+*/
+void SpeckMacModule::ignoreEvent()
+{
+}
+
+/*!
+	\brief Put the radio to sleep (MAC_SELF_SET_RADIO_SLEEP in MAC_STATE_DEFAULT).
+	
+	This method performs duty cycling, along with dutyCycleWakeup(). Every sleepInterval seconds, the radio switches on and a sleep message is scheduled after listenInterval seconds, and vice versa. 
+ */
+void SpeckMacModule::dutyCycleSleep()
+{
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Radio sleep.";
+	
+	setRadioState(MAC_2_RADIO_ENTER_SLEEP); // switch to sleep mode.
+		
+	rescheduleSelfMessage(dutyCycleWakeupMsg, localToSim(sleepInterval * energySleepScale + pendingPhaseShift));
+	pendingPhaseShift = 0.0;
+}
+
+/*!
+	\brief The expected frame was not received before the sleep message (MAC_SELF_SET_RADIO_SLEEP in MAC_STATE_EXPECTING_RX).
+*/
+void SpeckMacModule::expectedRxFailed()
+{
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Rx failed.";
+	rxFailed++;
+	setMacState(MAC_STATE_DEFAULT, "MAC_SELF_SET_RADIO_SLEEP received when MAC_STATE_EXPECTING_RX");
+	
+	dutyCycleSleep();
+}
+
+/*!
+	\brief Wake the radio up (MAC_SELF_WAKEUP_RADIO in MAC_STATE_DEFAULT).
+	
+	The radio is switched on, the sleep message is scheduled after listenInterval seconds, and a carrier sense is initiated to check for frames in the medium.
+ */
+void SpeckMacModule::dutyCycleWakeup()
+{		
+	if (deferToTrainEnd(dutyCycleWakeupMsg))
+		return;
+	
+	checkEnergyTier();
+	
+	if (adaptiveDutyCycle)
+		adaptDutyCycle();
+	
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"]t = "<< simTime() << ": Radio wakeup";
+	
+	setRadioState(MAC_2_RADIO_ENTER_LISTEN);
+	
+	lastWakeupTime = simTime(); // This is the time the node wakes up.
+	clearCCAs = 0;
+	
+	rescheduleSelfMessage(dutyCycleSleepMsg, localToSim(listenInterval)); // Get radio to go to sleep
+	
+	initiateCarrierSense();
+}
+
+/*!
+	\brief Handles network layer packets received from the Network module.
+	
+	This method is executed whenever the MAC module receives a network layer frame (case NET_FRAME). Frames whose priority is too low for the energy tier are refused (see refusedByEnergyTier()). It encapsulates the network layer packet into a MAC layer frame, which is queued at the level given by the priority of the network frame, and expires txFrameLifetime after it was received (if set), sets the \b{doTx} flag to indicate that the module has to transmit the packet to the radio, and schedules a message that pushes the frame into the transmission buffer. It then schedules, after a random offset period which may be defined in the ini file, the initiation of transmission to the radio layer.
+	
+	\param msg
+	This parameter holds the network layer packet received. The method takes ownership of the packet: it is either attached to the MAC frame without being copied, or deleted.
+*/
+void SpeckMacModule::handleNetworkLayerFrame(cMessage *msg)
+{
+	if (refusedByEnergyTier(msg->priority()))
+	{
+		SPECKMAC_TRACE << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Pkt of priority " << msg->priority() << " refused in energy tier " << energyTier;
+		delete msg;
+		energyTierDrops++;
+		return;
+	}
+	
+	if (!schedTXBuffer.full() || dropOldestWhenFull)
+	{
+		Network_GenericFrame *rcvNetDataFrame = check_and_cast<Network_GenericFrame*>(msg);
+		// Create the MACFrame from the Network Data Packet (encapsulation)	
+		SpeckMacFrame *dataFrame;
+		
+		if (nameFrames)
+		{
+			char buff[50];
+		
+			sprintf(buff, "MAC Data frame (%f)", simTime());
+			dataFrame = new SpeckMacFrame(buff, MAC_FRAME);
+		}
+		else
+		{
+			dataFrame = new SpeckMacFrame(NULL, MAC_FRAME);
+		}
+		
+		// Network_GenericFrame carries no TTL; the message priority selects the buffer level, and the deadline is set by the MAC.
+		dataFrame->setTxPriority(rcvNetDataFrame->priority() < 0 ? 0 : rcvNetDataFrame->priority());
+		if (txFrameLifetime > 0.0)
+			dataFrame->setDeadline(simTime() + txFrameLifetime);
+		
+		if(encapsulateNetworkFrame(rcvNetDataFrame, dataFrame))
+		{
+			doTx = TRUE; // indicate that tx has to be performed. This is because both Tx and Rx use Carrier sense.
+			
+			dataFrame->setKind(MAC_FRAME_SELF_PUSH_TX_BUFFER); // the dataFrame is a pointer of type MAC_GenericFrame*
+			scheduleAt(simTime(), dataFrame); // not posted (see postSelfMessage()): the initiation of the transmission below follows it.
+			// (int) ((sleepInterval * radioDataRate * 1000) / ((rcvNetDataFrame->byteLength() + macFrameOverhead) * 8) );
+			//pushFrameIntoBuffer(msg);
 			
-			// Put node back to sleep; dont perform carrier sense.
-			scheduleAt(simTime() + DRIFTED_TIME(listenInterval), new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP));
+			// A pending initiation already covers every frame in the buffer.
+			if (!initiateTxMsg->isScheduled())
+				scheduleAt(simTime() + localToSim(jitter() * randomTxOffset), initiateTxMsg);
+		}
+		else
+		{
+			cancelAndDelete(dataFrame);
+			dataFrame = NULL;
+			delete rcvNetDataFrame;
+			oversizedDrops++;
+			CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": WARNING: Network module sent to MAC an oversized packet...packet dropped!!\n";
 		}
+		
+		rcvNetDataFrame = NULL;
+		dataFrame = NULL;
+	}
+	else
+	{
+		delete msg;
+		bufferFullDrops++;
 	}
+}
+
+/*!
+	\brief Initiates carrier sense.
+	
+	SpeckMAC performs carrier sense under two circumstances: (a) if the node is checking for packets in the medium, and (b) if the node requires to transmit, and needs to perform a Clear Channel Assessment (CCA) a priori. It schedules a MAC_SELF_PERFORM_CARRIER_SENSE message.
 	
+	\note This method is only called in MAC_STATE_DEFAULT or MAC_STATE_TRY_TX; there is no point carrier sensing when the Mac is already in TX mode, or in MAC_STATE_EXPECTING_RX.
+ */
+void SpeckMacModule::initiateCarrierSense()
+{
+	if ( ((doTx == TRUE) && !schedTXBuffer.empty()) || (doTx == FALSE) ) // either packet to be transmitted, and buffer not empty, or no packet to  be transmitted, perform carrier sense
+	{
+		// perform carrier sense NOW!
+		SPECKMAC_TRACE << "\n[SpeckMAC_" << self << "] t= " << simTime() << " Perform Carrier Sense.";
+		postSelfMessage(performCSMsg);
+	}							  
+	else if ( (doTx == TRUE) && schedTXBuffer.empty() )
+	{
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": WARNING: MAC_SELF_INITIATE_TX received but Mac Buffer is empty.\n";
+
+		setMacState(MAC_STATE_DEFAULT, "MAC_SELF_INITIATE_TX received and buffer is empty");
+		
+		// Put node back to sleep; dont perform carrier sense.
+		rescheduleSelfMessage(dutyCycleSleepMsg, localToSim(listenInterval));
+	}
 }
 
 /*!
@@ -487,62 +1025,56 @@ void SpeckMacModule::initiateCarrierSense()
  */
 void SpeckMacModule::performCarrierSense()
 {
-	if ( (macState == MAC_STATE_DEFAULT) || (macState == MAC_STATE_TRY_TX) )
-	{		
-		int isCarrierSenseValid_ReturnCode; // during this procedure we check if the carrier sense indication of the Radio is valid.
-		isCarrierSenseValid_ReturnCode = radioModule->isCarrierSenseValid();
+	int isCarrierSenseValid_ReturnCode; // during this procedure we check if the carrier sense indication of the Radio is valid.
+	isCarrierSenseValid_ReturnCode = carrierSenseValidity();
 
-		if(isCarrierSenseValid_ReturnCode == 1) // carrier sense indication of Radio is Valid
-		{
-			// send the delayed message with the command to perform Carrier Sense to the radio
-			MAC_ControlMessage *csMsg = new MAC_ControlMessage("carrier sense strobe MAC->radio", MAC_2_RADIO_SENSE_CARRIER);
-			
-			csMsg->setSense_carrier_interval(CARRIER_SENSE_INTERVAL); // Add a random value.
-			send(csMsg, "toRadioModule"); // Send message to radio module NOW.
+	if(isCarrierSenseValid_ReturnCode == 1) // carrier sense indication of Radio is Valid
+	{
+		// send the delayed message with the command to perform Carrier Sense to the radio
+		MAC_ControlMessage *csMsg = new SpeckMacControlMessage(messageName("carrier sense strobe MAC->radio"), MAC_2_RADIO_SENSE_CARRIER);
+		
+		csMsg->setSense_carrier_interval(CARRIER_SENSE_INTERVAL); // Add a random value.
+		send(csMsg, "toRadioModule"); // Send message to radio module NOW.
 
-			selfExitCSMsg = new MAC_ControlMessage("Exit carrier sense state MAC->MAC", MAC_SELF_EXIT_CARRIER_SENSE);
-			scheduleAt(simTime() + CARRIER_SENSE_INTERVAL + epsilon, selfExitCSMsg);
+		// The strobe, and the busy report, each take radioLinkDelay to arrive.
+		rescheduleSelfMessage(selfExitCSMsg, localToSim(CARRIER_SENSE_INTERVAL) + 2 * radioLinkDelay + epsilon);
 
-			macState = MAC_STATE_CARRIER_SENSING; // Indicate that SpeckMAC will now perform carrier sensing.
-			
-			if(printStateTransitions)
-				CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_CARRIER_SENSING (MAC_SELF_PERFORM_CARRIER_SENSE received)";
-		}
-		else // carrier sense indication of Radio is NOT Valid and isCarrierSenseValid_ReturnCode holds the cause for the non valid carrier sense indication. **This should not happen, as I switch the radio to listen a lot earlier.**
+		setMacState(MAC_STATE_CARRIER_SENSING, "MAC_SELF_PERFORM_CARRIER_SENSE received"); // Indicate that SpeckMAC will now perform carrier sensing.
+	}
+	else // carrier sense indication of Radio is NOT Valid and isCarrierSenseValid_ReturnCode holds the cause for the non valid carrier sense indication. **This should not happen, as I switch the radio to listen a lot earlier.**
+	{
+		switch(isCarrierSenseValid_ReturnCode)
 		{
-			switch(isCarrierSenseValid_ReturnCode)
+			case RADIO_IN_TX_MODE:
 			{
-				case RADIO_IN_TX_MODE:
-				{
-					// send the packet (+ the precending beacons) to the Radio Buffer  by sending a message to ourselves
-					scheduleAt(simTime(), new MAC_ControlMessage("check schedTXBuffer buffer", MAC_SELF_CHECK_TX_BUFFER));
-					break;
-				}
-
-				case RADIO_SLEEPING:
-				{
-					// wake up the radio
-					setRadioState(MAC_2_RADIO_ENTER_LISTEN);
-					// send to ourselves a MAC_SELF_PERFORM_CARRIER_SENSE with delay equal to the time needed by the radio to have a valid CS indication after switching to LISTENING state
-					scheduleAt(simTime() + DRIFTED_TIME(radioDelayForValidCS) + epsilon, new MAC_ControlMessage("Enter carrier sense state MAC->MAC", MAC_SELF_PERFORM_CARRIER_SENSE));
-					break;
-				}
-
-				case RADIO_NON_READY:
-				{
-					//send to ourselves a MAC_SELF_PERFORM_CARRIER_SENSE with delay equal to the time needed by the radio to have a valid CS indication after switching to LISTENING state
-					scheduleAt(simTime() + DRIFTED_TIME(radioDelayForValidCS), new MAC_ControlMessage("Enter carrier sense state MAC->MAC", MAC_SELF_PERFORM_CARRIER_SENSE));
-
-					break;
-				}
-
-				default:
-				{
-					CASTALIA_DEBUG << "\n[SpeckMAC_"<< self <<"] t= " << simTime() << ": WARNING: In MAC module, radioModule->isCarrierSenseValid(reasonNonValid) return invalid reasonNonValid.\n";
-					break;
-				}
-			}//end_switch
-		}
+				// send the packet (+ the precending beacons) to the Radio Buffer  by sending a message to ourselves
+				rescheduleSelfMessage(checkTxBufferMsg);
+				break;
+			}
+
+			case RADIO_SLEEPING:
+			{
+				// wake up the radio
+				setRadioState(MAC_2_RADIO_ENTER_LISTEN);
+				// send to ourselves a MAC_SELF_PERFORM_CARRIER_SENSE with delay equal to the time needed by the radio to have a valid CS indication after switching to LISTENING state
+				rescheduleSelfMessage(performCSMsg, localToSim(radioDelayForValidCS) + epsilon);
+				break;
+			}
+
+			case RADIO_NON_READY:
+			{
+				//send to ourselves a MAC_SELF_PERFORM_CARRIER_SENSE with delay equal to the time needed by the radio to have a valid CS indication after switching to LISTENING state
+				rescheduleSelfMessage(performCSMsg, localToSim(radioDelayForValidCS));
+
+				break;
+			}
+
+			default:
+			{
+				CASTALIA_DEBUG << "\n[SpeckMAC_"<< self <<"] t= " << simTime() << ": WARNING: In MAC module, radioModule->isCarrierSenseValid(reasonNonValid) return invalid reasonNonValid.\n";
+				break;
+			}
+		}//end_switch
 	}
 }
 
@@ -555,383 +1087,956 @@ void SpeckMacModule::performCarrierSense()
 	In this case, the module switches to MAC_STATE_EXPECTING_RX, and waits for a frame for a maximum time equal to the length of two maximum sized MAC frames.
 
 	\par Perform CCA to transmit.
-	If blocking send is enabled, the module defers transmission and waits for a frame for a maximum time equal to the length of two maximum sized MAC frames. If not, the frame is discarded, and the node switches to receiving mode as described above. 
-
-	\note Blocking send is enabled by default.
+	If blocking send is enabled (blockingSend), the module defers transmission. If not, the frame is discarded. In both cases, the node then switches to MAC_STATE_EXPECTING_RX, and waits for a frame for a time chosen by the back-off policy (see BackoffPolicy) before it goes back to duty cycling.
+	\note Only dispatched in MAC_STATE_CARRIER_SENSING and MAC_STATE_DEFAULT (see transitionTable).
  */
 void SpeckMacModule::carrierBusy()
 {
 	// The channel is not free; therefore, the impending carrier sense exit message must be cancelled in order not to give the false impression that the channel is free.
-#ifdef DEBUG
-	if ( (self == 6) || (self == 5) )
-		CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Carrier Busy, MAC State = " << macState;
-#endif
+	SPECKMAC_TRACE <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Carrier Busy, MAC State = " << macState;
+	
+	cancelSelfMessage(selfExitCSMsg);
+	
+	carrierBusyCount++;
+	backoff->carrierSensed(true);
 	
-	if (( selfExitCSMsg != NULL ) && (  selfExitCSMsg->isScheduled() ))
+	// Repeated busy carrier senses suggest that the node is synchronised with a neighbour; shift the phase of the duty cycle.
+	consecutiveBusyCCAs++;
+	if ( (rephaseAfterBusyCCAs > 0) && (consecutiveBusyCCAs >= rephaseAfterBusyCCAs) )
 	{
-		cancelAndDelete(selfExitCSMsg);
-		selfExitCSMsg = NULL;
+		pendingPhaseShift = jitter() * sleepInterval;
+		consecutiveBusyCCAs = 0;
+		rephases++;
+		SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Shift duty cycle phase by " << pendingPhaseShift;
 	}
+	clearCCAs = 0;
+	if (doTx == TRUE)
+		busyWhileTx++;
+	else
+		busyWhileListening++;
+	if (recordVectors)
+		carrierSenseVector.record(1);
 	
-	if ( (macState == MAC_STATE_CARRIER_SENSING) || (macState == MAC_STATE_DEFAULT) ) // very very debug. May cause side-effects.
+	if (doTx == TRUE) // pkt to be Txed
 	{
+		// Try retransmitting after sleepInterval seconds; so that all redundant retransmissions have cleared.
+		// scheduleAt(simTime() + localToSim(sleepInterval), new MAC_ControlMessage("try transmitting after backing off", MAC_SELF_INITIATE_TX));
 		
-		if (doTx == TRUE) // pkt to be Txed
+		if (!blockingSend)
 		{
-			// Try retransmitting after sleepInterval seconds; so that all redundant retransmissions have cleared.
-			// scheduleAt(simTime() + DRIFTED_TIME(sleepInterval), new MAC_ControlMessage("try transmitting after backing off", MAC_SELF_INITIATE_TX));
+			// If NOT blocking send; drop the frame.
+			CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Pkt send failed, and pkt buffer size = " << getTXBufferSize() << "; Mac State =" << macState ;
 			
+			MAC_GenericFrame* rubbish = popTxBuffer(false); // one network frame per drop; frames are only aggregated once they are sent.
 			
-#ifndef BLOCKING
-		// If NOT blocking send; i.e., repeated tries till failure; disabled.
-#ifdef DEBUG
-		CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Pkt send failed, and pkt buffer size = " << getTXBufferSize() << "; Mac State =" << macState ;
-#endif
-				
-			MAC_GenericFrame* rubbish = popTxBuffer();
-				
-				// If everything has been popped out
+			// If everything has been popped out
 			if (getTXBufferSize() == 0)
 			{
 				doTx = FALSE;
 			}
-				
+			
+			if (rubbish != NULL) // NULL if the frames left had expired.
+				busyDrops++;
 			delete rubbish;
 			rubbish = NULL;
-				
-			macState = MAC_STATE_EXPECTING_RX;
-				
-			if (printStateTransitions)
-			{
-				CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() <<"; Mac State =" << macState << " i.e. changed to MAC_EXPECTING_RX";
-			}
-				
-				// Cancel currently scheduled sleep
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-			}
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-			}
-				
-#else
-				// ********************** THIS HAS BEEN TESTED, AND WORKS ****************************************** 
-				// If blocking send; don't delete the packet.
-#ifdef DEBUG
-			CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Pkt send failed, and pkt buffer size = " << getTXBufferSize() << "; retry after sleeping for sleepInterval. Mac State =" << macState ;
-#endif		
-			// Cancel currently scheduled sleep, and schedule another sleep for after the length of two longest possible frames.
-			// This is to ensure that the node doesn't have the radio permanently turned on by random noise, or incompletely received packets.
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-			}
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-			}
-			
-			macState = MAC_STATE_EXPECTING_RX;
-				
-			if (printStateTransitions)
-			{
-				CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() <<"; Mac State =" << macState << " i.e. changed to MAC_EXPECTING_RX";
-			}
-			
-			dutyCycleSleepMsg = new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP);
-			scheduleAt(simTime() + DRIFTED_TIME((double) (2 * maxMacFrameSize * 8 / (1000.0 * radioDataRate))), dutyCycleSleepMsg); 	
-#ifdef DEBUG
-			if ( (self == 5) || (self == 6) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep after " << ( (2 *maxMacFrameSize * 8) / (1000.0 * radioDataRate) );	
-#endif
-			
-#endif	// blocking		
 		}
-		else // This was a carrier sense to see if medium had packets.
+		else
 		{
-			// Cancel currently scheduled sleep, and schedule another sleep for after the length of two longest possible frames.
-			// This is to ensure that the node doesn't have the radio permanently turned on by random noise, or incompletely received packets.
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-			}
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-			}
-			
-			macState = MAC_STATE_EXPECTING_RX;
-			
+			// ********************** THIS HAS BEEN TESTED, AND WORKS ****************************************** 
+			// If blocking send; don't delete the packet.
+			CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Pkt send failed, and pkt buffer size = " << getTXBufferSize() << "; retry after sleeping for sleepInterval. Mac State =" << macState ;
+		}
+		
+		// Cancel currently scheduled sleep, and schedule another sleep after the back-off delay.
+		// This is to ensure that the node doesn't have the radio permanently turned on by random noise, or incompletely received packets.
+		cancelSelfMessage(dutyCycleWakeupMsg);
+		cancelSelfMessage(dutyCycleSleepMsg);
+		
+		setMacState(MAC_STATE_EXPECTING_RX, blockingSend ? "carrier busy, transmission deferred" : "carrier busy, frame dropped");
+		
+		double backoffDelay = localToSim(backoff->backoff(jitter()));
+		rescheduleSelfMessage(dutyCycleSleepMsg, backoffDelay);
+		SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep after " << backoffDelay;
+	}
+	else // This was a carrier sense to see if medium had packets.
+	{
+		// Cancel currently scheduled sleep, and schedule another sleep for after the length of two longest possible frames.
+		// This is to ensure that the node doesn't have the radio permanently turned on by random noise, or incompletely received packets.
+		cancelSelfMessage(dutyCycleWakeupMsg);
+		cancelSelfMessage(dutyCycleSleepMsg);
+		
+		setMacState(MAC_STATE_EXPECTING_RX, "carrier busy");
+
+		// put radio to sleep.
+		rescheduleSelfMessage(dutyCycleSleepMsg, localToSim(expectingRxTimeout));
+		
+		SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep after " << expectingRxTimeout;
+	}
+}
+
+/*!
+	\brief Handles channel free condition.
+	
+	This method is called if the channel is free. There are two possibilities:
+	\par Check for frames in the medium.
+	In this case, the module performs carrier sense again, if there is time left in the listenInterval to perform another carrier sense. This is a modification to SpeckMAC to deal with packet-based radios. The original implementation on the Prospeckz IIK used the CC2420 radio's stream mode.
+	If early sleep is enabled (earlySleepClearCCAs), the radio is instead put to sleep once the channel has been found idle for long enough; see channelIdleLongEnough().
+
+	\par Perform CCA to transmit.
+	The node transmits the frame. With unicastEarlyAck, the sender of a unicast train leaves the channel idle for ackWaitTime after each copy, while it listens for the ack; a single clear carrier sense may fall in that gap. The node hence carrier senses again until its consecutive clear carrier senses cover the gap, and only transmits then.
+	\note Only dispatched in MAC_STATE_CARRIER_SENSING (see transitionTable).
+	\bug Sometimes it is possible for two nodes to be perfectly synchronised. This is dealt with by the random offset introduced to MAC_SELF_INITIATE_TX. This is not entirely effective. However, by adding an offset before transmission in the application layer, delivery ratios equal to 100% may be achieved. Offsetting the phase of the duty cycle at startup (startupPhaseJitter), and shifting it after repeated busy carrier senses (rephaseAfterBusyCCAs), also breaks the synchronisation.
+ */
+void SpeckMacModule::carrierFree()
+{
+	SPECKMAC_TRACE << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Carrier Free";
+	if (recordVectors)
+		carrierSenseVector.record(0);
+	backoff->carrierSensed(false);
+	consecutiveBusyCCAs = 0;
+	setMacState(MAC_STATE_DEFAULT, "MAC_SELF_EXIT_CARRIER_SENSE received when MAC_STATE_CARRIER_SENSING; carrier is free");
+	
+	if (clearCCAs == 0)
+		clearCCAsStart = simTime() - localToSim(CARRIER_SENSE_INTERVAL) - epsilon; // the time this carrier sense started.
+	clearCCAs++;
+	
+	if ( (doTx == TRUE) && unicastEarlyAck && ((simTime() - clearCCAsStart) < localToSim(ackWaitTime) + 2 * epsilon) )
+	{
+		SPECKMAC_TRACE <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Redo carrier sense to cover the gaps of early-ack trains";
+		initiateCarrierSense();
+	}
+	else if (doTx == TRUE) // if pkt to be Txed, schedule a message NOW that will check the Tx buffer for transmission
+	{
+		// This is because the node could be in wakeup state and already performing carrier sense when a message comes through.
+		CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Retxing";
+		cancelSelfMessage(dutyCycleWakeupMsg);
+		cancelSelfMessage(dutyCycleSleepMsg);
+		
+		postSelfMessage(checkTxBufferMsg);
+	}
+	// If not, this was a carrier sense just to see if the medium had packets. It does not; so run another carrier sense.
+	else
+	{
+		if (channelIdleLongEnough())
+		{
+			sleepEarly();
+			return;
+		}
+		
+		double timeLeftListening;
+		timeLeftListening = listenInterval - localClock.toLocalTime(simTime() - lastWakeupTime, simTime()); // as measured by the node's timer.
+		if (timeLeftListening > (radioDelayForValidCS + CARRIER_SENSE_INTERVAL) ) // If there's time for another carrier sense, do IT!
+		{
+			SPECKMAC_TRACE <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Redo carrier sense";
+			initiateCarrierSense();
+		}
+	}
+}
+
+/*!
+	\brief Decide whether the node may stop listening before the end of listenInterval.
+	
+	A SpeckMAC-D sender transmits its frame back to back for a whole sleepInterval, so a carrier sense at any time while the train is on the air finds the carrier busy. If at least earlySleepClearCCAs consecutive carrier senses, spanning at least the time to transmit a maximum sized frame, have found the channel clear, there is no train to receive.
+	
+	\return true if early sleep is enabled, and the consecutive clear carrier senses since the last wakeup or busy carrier sense satisfy both conditions.
+*/
+bool SpeckMacModule::channelIdleLongEnough()
+{
+	if ( (earlySleepClearCCAs <= 0) || (clearCCAs < earlySleepClearCCAs) )
+		return false;
+	
+	return (simTime() - clearCCAsStart) >= localToSim(earlySleepSpan);
+}
+
+/*!
+	\brief Put the radio to sleep before the end of listenInterval.
+	
+	The pending sleep message is cancelled, and the next wakeup is scheduled at the time it would have been if the node had listened for the whole listenInterval; early sleep thus does not shift the node's duty cycle.
+*/
+void SpeckMacModule::sleepEarly()
+{
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t = "<< simTime() << ": Radio sleep early, after " << clearCCAs << " clear carrier senses.";
+	earlySleeps++;
+	clearCCAs = 0;
+	
+	cancelSelfMessage(dutyCycleSleepMsg);
+	setRadioState(MAC_2_RADIO_ENTER_SLEEP);
+	
+	double nextWakeupTime = lastWakeupTime + localToSim(listenInterval) + localToSim(sleepInterval * energySleepScale + pendingPhaseShift);
+	pendingPhaseShift = 0.0;
+	rescheduleSelfMessage(dutyCycleWakeupMsg, nextWakeupTime - simTime());
+}
+
+/*!
+	\brief Sends data to the radio module.
+	
+	This method is called \b if the channel is free. It is used to transmit the frame at the head of the transmit buffer. The SpeckMAC-D algorithm performs most of its work in this method. It determines the number of frames that can be transmitted in the sleep interval,\b n, and sends \b n \b + \b 1 redundant frames.
+	The redundant copies share the payload of the frame, so only the MAC header is copied. The frame popped from the buffer is itself sent as the last copy.
+	
+	In train mode (txTrainMode), only the first copy is sent here; each of the following copies is sent by finishDataTransmission() when the radio reports that it has finished sending the previous one. The future event set thus holds a constant number of events per node, however large the redundancy.
+	\note Only dispatched in MAC_STATE_TX and MAC_STATE_DEFAULT; MAC_SELF_CHECK_TX_BUFFER in any other state goes to unexpectedTxBufferCheck().
+	\bug Since sleepInterval/packetSize is not always an integer, we round up! This could result in multiple packet receives. But this is easier to deal with, and less harmful than the other possibility - packet loss.
+ */
+void SpeckMacModule::sendData()
+{
+	if (!schedTXBuffer.empty())
+	{
+		// SEND THE DATA FRAME TO RADIO BUFFER repeatedly; until the buffer is empty.
+	
+		SpeckMacFrame *dataFrame, *dupFrame;
+		dataFrame = popTxBuffer(aggregateFrames);
+		
+		if (dataFrame == NULL) // every frame left in the buffer had expired.
+		{
+			doTx = FALSE;
+			sleepUntilNextWakeup();
+			return;
+		}
+		
+		framesSent++;
+		backoff->transmitted();
+		copiesSent += redundancy;
+		dataFrame->setTrainLength(redundancy + 1); // inherited by the copies.
+		dataFrame->setSleepInterval(advertisedSleepInterval * advertisedSleepScale);
+		
+		// The neighbours that hear the train learn of the longer sleep before the node starts sleeping for it.
+		if (advertisedSleepInterval > sleepInterval)
+			setSleepInterval(advertisedSleepInterval, "advertised");
+		energySleepScale = advertisedSleepScale;
+		
+		// The train has covered the old sleep interval; the following ones only need to cover the current one, and the longest one of the neighbours.
+		double coverInterval = (neighbourSleepInterval > sleepInterval) ? neighbourSleepInterval : sleepInterval;
+		if (trainCoverInterval != coverInterval)
+		{
+			trainCoverInterval = coverInterval;
+			precomputeRedundancies();
+		}
+		
+		// Unicast frames are sent one copy at a time with early acks, so that the rest of the train can be cancelled.
+		trainAwaitsAck = unicastEarlyAck && (dataFrame->getHeader().destID != BROADCAST_ADDR);
+		dataFrame->setCopyGap(trainAwaitsAck ? ackWaitTime : 0.0); // the receivers defer to the end of the train, waits for acks included.
+		
+		if (txTrainMode || trainAwaitsAck)
+		{
+			trainFrame = dataFrame;
+			trainCopiesSent = 0;
+			sendNextTrainCopy();
+			return;
+		}
+		
+		for (int i = 0; i <= redundancy; i++) // Send multiple packets - redundancy + 1. Send them back to back.
+		{
+			dupFrame = (i < redundancy) ? (SpeckMacFrame *)dataFrame->dup() : dataFrame; // copies share the payload.
+			dupFrame->setTrainIndex(i);
+			sendDelayed(dupFrame, localToSim(i*dataTXtime) ,"toRadioModule");
+			setRadioState(MAC_2_RADIO_ENTER_TX, localToSim(i*dataTXtime) + epsilon); // Remove epsilon.??
+		}
+		
+		dataFrame = NULL; // sent as the last copy.
+		
+		// If the buffer is still not empty; i.e., the node has more packets to send, sleep for a short period = length of data packet + epsilon, so u restart carrier sense after that
+		
+		// check to see if we must schedule extra transmissions
+	}
+}
+
+/*!
+	\brief Handles MAC_SELF_CHECK_TX_BUFFER in a state where no transmission may start.
+	
+	The application will never enter this, as MAC_SELF_CHECK_TX_BUFFER is sent only in MAC_STATE_DEFAULT or MAC_STATE_TX. But as a safeguard, the module returns to MAC_STATE_DEFAULT and puts the radio to sleep.
+*/
+void SpeckMacModule::unexpectedTxBufferCheck()
+{
+	if (!schedTXBuffer.empty())
+	{
+		setMacState(MAC_STATE_DEFAULT, "MAC_SELF_CHECK_TX_BUFFER received in unexpected state. ERROR: THIS CODE SHOULD NOT BE EXECUTED.");
+		setRadioState(MAC_2_RADIO_ENTER_SLEEP); // for a period equal to one guard period, there is no transmission.
+	}
+}
+
+/*!
+	\brief Send the next copy of the frame being sent in train mode.
+	
+	The copy is sent to the radio immediately, followed by the command to transmit it. The frame itself is sent as the last copy.
+*/
+void SpeckMacModule::sendNextTrainCopy()
+{
+	SpeckMacFrame *copyFrame;
+	
+	if (trainCopiesSent < redundancy)
+	{
+		copyFrame = (SpeckMacFrame *)trainFrame->dup(); // copies share the payload.
+	}
+	else
+	{
+		copyFrame = trainFrame;
+		trainFrame = NULL;
+	}
+	copyFrame->setTrainIndex(trainCopiesSent);
+	trainCopiesSent++;
+	
+	send(copyFrame, "toRadioModule");
+	setRadioState(MAC_2_RADIO_ENTER_TX, epsilon);
+}
+
+/*!
+	\brief No early ack was received after the last copy of a unicast train (SPECKMAC_SELF_ACK_TIMEOUT in MAC_STATE_TX); send the next copy.
+*/
+void SpeckMacModule::ackTimeout()
+{
+	sendNextTrainCopy();
+}
+
+/*!
+	\brief Send an early ack for a unicast frame received by its destination.
+	
+	The ack carries the sequence number of the frame, and only the MAC header. The node switches to MAC_STATE_TX once the radio starts sending it, and goes to sleep when the radio has finished (see finishDataTransmission()).
+*/
+void SpeckMacModule::sendAck(SpeckMacFrame *rcvFrame)
+{
+	cancelSelfMessage(dutyCycleWakeupMsg);
+	cancelSelfMessage(dutyCycleSleepMsg);
+	
+	SpeckMacFrame *ackFrame = new SpeckMacFrame(messageName("MAC early ack"), MAC_FRAME);
+	ackFrame->setByteLength(macFrameOverhead);
+	ackFrame->getHeader().srcID = self;
+	ackFrame->getHeader().destID = rcvFrame->getHeader().srcID;
+	ackFrame->getHeader().frameType = SPECKMAC_ACK_FRAME;
+	ackFrame->setSeqNum(rcvFrame->getSeqNum());
+	
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Ack Pkt " << rcvFrame->getSeqNum() << " to " << rcvFrame->getHeader().srcID;
+	acksSent++;
+	
+	send(ackFrame, "toRadioModule");
+	setRadioState(MAC_2_RADIO_ENTER_TX, epsilon);
+}
+
+/*!
+	\brief Handle an early ack.
+	
+	If the ack is for the unicast train being sent, the rest of the train is cancelled, and the transmission completes as if the last copy had been sent. Acks overheard by other nodes, and late acks, are ignored.
+*/
+void SpeckMacModule::receiveAck(SpeckMacFrame *ackFrame)
+{
+	if ( (ackFrame->getHeader().destID != self) || (trainFrame == NULL) || !trainAwaitsAck || !ackTimeoutMsg->isScheduled() )
+		return;
+	
+	if ( (ackFrame->getHeader().srcID != trainFrame->getHeader().destID) || (ackFrame->getSeqNum() != trainFrame->getSeqNum()) )
+		return;
+	
+	SPECKMAC_TRACE << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Rx ack for Pkt " << ackFrame->getSeqNum() << " after " << trainCopiesSent << " copies";
+	acksReceived++;
+	copiesSaved += redundancy + 1 - trainCopiesSent;
+	copiesSent -= redundancy + 1 - trainCopiesSent;
+	
+	cancelSelfMessage(ackTimeoutMsg);
+	delete trainFrame;
+	trainFrame = NULL;
+	
+	finishDataTransmission();
+}
+
+/*!
+	\brief Mop-up tasks after data transmission
+	
+	This method is called when the radio module completes transmission in MAC_STATE_TX, and schedules additional transmissions if necessary. Additional transmissions are carried out after a guard period, to prevent a given node locking the channel.
+	In train mode, the next copy of the frame is sent instead, until all redundant copies have been sent. For a unicast frame with unicastEarlyAck, the node first listens for an early ack (see ackTimeout() and receiveAck()).
+	With aggregateFrames set, the frames queued for the same destination are sent in the same MAC frame (see popTxBuffer()), so a burst no longer waits one duty cycle per network frame.
+	\todo Test with multiple packets per node per try; i.e., at higher data rates, without aggregateFrames.
+ */
+void SpeckMacModule::finishDataTransmission()
+{
+	if (trainFrame != NULL)
+	{
+		if (trainAwaitsAck)
+		{
+			// Listen for an early ack from the destination before sending the next copy.
+			setRadioState(MAC_2_RADIO_ENTER_LISTEN);
+			rescheduleSelfMessage(ackTimeoutMsg, localToSim(ackWaitTime) + 2 * epsilon);
+		}
+		else
+		{
+			sendNextTrainCopy();
+		}
+		return;
+	}
+	
+	setMacState(MAC_STATE_DEFAULT, "RADIO_2_MAC_STOPPED_TX received when MAC_STATE_TX; i.e., transmission complete");
 			
-			if (printStateTransitions)
-			{
-				CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() <<"; Mac State =" << macState << " i.e. changed to MAC_EXPECTING_RX";
-			}
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Put radio to sleep till next SELF_INITIATE_TX or WAKEUP";
+							
+	if (!schedTXBuffer.empty())
+	{
+		CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t= " << simTime() << ": Schedule additional transmissions";
+			// Which is, like, now.
+		
+		rescheduleSelfMessage(initiateTxMsg, localToSim(dataTXtime) + epsilon); // restart carrier sense after guard period.
+	}
+	else // The buffer is empty.
+	{
+		doTx = FALSE; // Since the buffer is empty, there are no more transmissions to be performed.
+		
+		CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t= " << simTime() << ": No additional transmissions. Tx complete. Wake up after sleeping for the guard period";
+	}
+	
+	sleepUntilNextWakeup();
+}
+
+/*!
+	\brief Put the radio to sleep until the next duty cycle wakeup.
+	
+	Also dispatched for RADIO_2_MAC_STOPPED_TX in states other than MAC_STATE_TX.
+*/
+void SpeckMacModule::sleepUntilNextWakeup()
+{
+	// Put node to sleep. NOW!
+	setRadioState(MAC_2_RADIO_ENTER_SLEEP);
+	rescheduleSelfMessage(dutyCycleWakeupMsg, localToSim(sleepInterval * energySleepScale));
+}
+
+/*!
+	\brief Reads parameters from the ini file.
+	
+	This method is called when the MAC module initialises. It loads parameters from the .ini file, into the appropriate class members.
+ */
+void SpeckMacModule::readIniFileParameters()
+{
+	printDebugInfo = par("printDebugInfo");
+	printStateTransitions = par("printStateTransitions");
+	promiscuous = par("promiscuous");
+	nameFrames = par("nameFrames");
+	
+	// Per-node traces are enabled for the node IDs listed in traceNodes; "*" enables them for all nodes.
+	traceThisNode = false;
+	cStringTokenizer traceTokenizer(par("traceNodes"));
+	const char *traceToken;
+	while ( (traceToken = traceTokenizer.nextToken()) != NULL )
+	{
+		if (strcmp(traceToken, "*") == 0)
+		{
+			traceThisNode = true;
+			continue;
+		}
+		
+		char *tokenEnd;
+		long traceID = strtol(traceToken, &tokenEnd, 10);
+		if ( (tokenEnd == traceToken) || (*tokenEnd != '\0') )
+			opp_error("\n[Mac]:\n traceNodes must list node IDs, or \"*\" (got \"%s\").", traceToken);
+		if (traceID == self)
+			traceThisNode = true;
+	}
+	
+	sleepInterval = par("sleepInterval");
+	adaptiveDutyCycle = par("adaptiveDutyCycle");
+	minSleepInterval = par("minSleepInterval");
+	maxSleepInterval = par("maxSleepInterval");
+	idleCyclesToLengthen = par("idleCyclesToLengthen");
+	if ( adaptiveDutyCycle && ((minSleepInterval <= 0.0) || (minSleepInterval > sleepInterval) || (sleepInterval > maxSleepInterval)) )
+		opp_error("\n[Mac]:\n The adaptive duty cycle requires 0 < minSleepInterval <= sleepInterval <= maxSleepInterval (%g, %g, %g).", minSleepInterval, sleepInterval, maxSleepInterval);
+	listenInterval = par("listenInterval");
+	randomTxOffset = par("randomTxOffset");
+	rngStream = par("rngStream");
+	startupPhaseJitter = par("startupPhaseJitter");
+	rephaseAfterBusyCCAs = par("rephaseAfterBusyCCAs");
+	txTrainMode = par("txTrainMode");
+	unicastEarlyAck = par("unicastEarlyAck");
+	blockingSend = par("blockingSend");
+	pdesMode = par("pdesMode");
+	radioLinkDelay = pdesMode ? (double) par("radioLinkDelay") : 0.0;
+	aggregateFrames = par("aggregateFrames");
+	earlySleepClearCCAs = par("earlySleepClearCCAs");
+	inlineZeroDelayHops = par("inlineZeroDelayHops");
+	recordVectors = par("recordVectors");
+	
+	maxMacFrameSize = par("maxMacFrameSize");
+	macBufferSize = par("macBufferSize");
+	macFrameOverhead = par("macFrameOverhead");
+	seqCacheSize = par("seqCacheSize");
+	queuePriorityLevels = par("queuePriorityLevels");
+	txFrameLifetime = par("txFrameLifetime");
+	
+	const char *bufferFullPolicy = par("bufferFullPolicy");
+	if (strcmp(bufferFullPolicy, "dropNewest") == 0)
+		dropOldestWhenFull = false;
+	else if (strcmp(bufferFullPolicy, "dropOldest") == 0)
+		dropOldestWhenFull = true;
+	else
+		opp_error("\n[Mac]:\n Unknown buffer full policy \"%s\" (expected dropNewest or dropOldest).", bufferFullPolicy);
+	
+	// Energy tier thresholds are listed in decreasing order, as fractions of the initial energy.
+	energyTierThresholds.clear();
+	cStringTokenizer tierTokenizer(par("energyTierThresholds"));
+	const char *tierToken;
+	while ( (tierToken = tierTokenizer.nextToken()) != NULL )
+	{
+		double threshold = atof(tierToken);
+		if ( (threshold <= 0.0) || (threshold >= 1.0) || (!energyTierThresholds.empty() && (threshold >= energyTierThresholds.back())) )
+			opp_error("\n[Mac]:\n energyTierThresholds must be fractions of the initial energy in (0, 1), in decreasing order (\"%s\").", (const char *) par("energyTierThresholds"));
+		energyTierThresholds.push_back(threshold);
+	}
+	energyCheckInterval = par("energyCheckInterval");
+	energyTierSleepFactor = par("energyTierSleepFactor");
+	energyTierListenFactor = par("energyTierListenFactor");
+	
+	checkpointFile = (const char *) par("checkpointFile");
+	restoreFile = (const char *) par("restoreFile");
+}
+
+/*!
+	\brief Precompute the transmission times and redundancies of MAC frames.
+	
+	This method is called when the MAC module initialises, once the radio parameters are known. All the inputs are fixed after initialisation except the length of the frame, which is bounded by maxMacFrameSize (and, with the adaptive duty cycle, the sleep interval: the redundancies are then tabulated again, see precomputeRedundancies()); the transmission time and the number of redundant copies are hence tabulated for every possible frame length, so that popTxBuffer() does not have to perform any division. It also caches the timeout used when the carrier is busy. All of these are local durations: they are converted into simulation time by localToSim() when they are scheduled, so that they follow the skew of the clock at that time.
+	
+ */
+void SpeckMacModule::precomputeFrameTimings()
+{
+	txTimeByLength.resize(maxMacFrameSize + 1);
+	redundancyByLength.resize(maxMacFrameSize + 1);
+	
+	for (int frameLength = 0; frameLength <= maxMacFrameSize; frameLength++)
+	{
+		double txTime = ((double)(frameLength + phyLayerOverhead) * 8.0 / (1000.0 * radioDataRate));
+		
+		txTimeByLength[frameLength] = txTime;
+	}
+	
+	trainCoverInterval = sleepInterval;
+	precomputeRedundancies();
+	
+	expectingRxTimeout = (double) (2 * maxMacFrameSize * 8 / (1000.0 * radioDataRate));
+	earlySleepSpan = txTimeByLength[maxMacFrameSize];
+	ackWaitTime = txTimeByLength[macFrameOverhead] + 2 * radioDelayForValidCS;
+}
+
+/*!
+	\brief Tabulate the number of redundant copies to send, for every frame length, so that a train covers trainCoverInterval.
+	
+	This is done when the module initialises, and again whenever trainCoverInterval changes with the adaptive duty cycle.
+	\note Rounding of the redundancy is done to the next highest integer.
+*/
+void SpeckMacModule::precomputeRedundancies()
+{
+	for (int frameLength = 0; frameLength <= maxMacFrameSize; frameLength++)
+		redundancyByLength[frameLength] = (int)( (trainCoverInterval / txTimeByLength[frameLength]) + 0.5); // to round it off to the next highest integer.
+}
+
+/*!
+	\brief Adapt sleepInterval to the traffic observed in the last duty cycle (adaptiveDutyCycle).
+	
+	This method is called on every wakeup. If frames are waiting in the transmission buffer behind the one being sent, or frames have been received since the last wakeup, the interval is halved, down to minSleepInterval: the node wakes up more often, and its trains are shorter. After idleCyclesToLengthen duty cycles without traffic, it is doubled, up to maxSleepInterval.
+	A neighbour that has not heard the longer interval would send trains too short for it, so the longer interval is only advertised here (advertisedSleepInterval); the node starts sleeping for it once it has sent a frame advertising it (see sendData()). A node that sends nothing hence keeps its interval.
+*/
+void SpeckMacModule::adaptDutyCycle()
+{
+	bool busy = (getTXBufferSize() > 1) || (framesReceived > framesReceivedAtAdaptation);
+	framesReceivedAtAdaptation = framesReceived;
+	
+	if (busy)
+	{
+		idleCycles = 0;
+		if (sleepInterval > minSleepInterval)
+			setSleepInterval((sleepInterval / 2 > minSleepInterval) ? sleepInterval / 2 : minSleepInterval, "traffic");
+		else
+			advertisedSleepInterval = sleepInterval; // a pending lengthening is dropped.
+	}
+	else if (++idleCycles >= idleCyclesToLengthen)
+	{
+		idleCycles = 0;
+		if (sleepInterval < maxSleepInterval)
+			advertisedSleepInterval = (sleepInterval * 2 < maxSleepInterval) ? sleepInterval * 2 : maxSleepInterval;
+	}
+}
+
+/*!
+	\brief Change sleepInterval.
+	
+	Neighbours that have not heard the new interval yet still sleep for the old one. If the interval is shortened, the next train hence still covers the old interval (trainCoverInterval); the neighbours that receive it adopt the interval it advertises (see receiveFrame()). The interval is only lengthened once it has been advertised (see adaptDutyCycle()).
+	
+	\param newInterval
+	The new sleep interval.
+	\param reason
+	The reason for the change, to be printed out.
+*/
+void SpeckMacModule::setSleepInterval(double newInterval, const char *reason)
+{
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": sleepInterval changed from " << sleepInterval << " to " << newInterval << " (" << reason << ")";
+	
+	if (newInterval > trainCoverInterval)
+	{
+		trainCoverInterval = newInterval;
+		precomputeRedundancies();
+	}
+	
+	sleepInterval = advertisedSleepInterval = newInterval;
+	sleepIntervalChanges++;
+	if (recordVectors)
+		sleepIntervalVector.record(sleepInterval);
+}
+
+/*!
+	\brief Poll the resource manager for the energy spent, and move to a lower energy tier if the remaining energy has dropped below its threshold.
+	
+	This is done at wakeups, at most once per energyCheckInterval, so that the resource manager is not called on every event. Tiers are only ever entered, as spent energy is not recovered.
+*/
+void SpeckMacModule::checkEnergyTier()
+{
+	if ( (energyTier >= (int) energyTierThresholds.size()) || (simTime() < nextEnergyCheck) )
+		return;
+	nextEnergyCheck = simTime() + energyCheckInterval;
+	
+	double remaining = 1.0 - resMgrModule->getSpentEnergy() / initialEnergy;
+	int tier = energyTier;
+	while ( (tier < (int) energyTierThresholds.size()) && (remaining < energyTierThresholds[tier]) )
+		tier++;
+	
+	if (tier > energyTier)
+		enterEnergyTier(tier, remaining);
+}
+
+/*!
+	\brief Enter energy tier \b tier.
+	
+	In tier k, the node sleeps energyTierSleepFactor^k times as long as sleepInterval, listens for energyTierListenFactor^k times listenInterval, and refuses the network frames of low priority.
+	sleepInterval itself is not changed, and still sets the length of the node's trains, as the neighbours keep waking up as often as before. The longer sleep is advertised in the frames the node sends, and the neighbours that hear it lengthen their trains to cover it (see receiveFrame()); the node only starts sleeping longer once it has sent such a frame (see sendData()), as its neighbours' trains would otherwise be too short for it.
+	
+	\param remaining
+	The remaining energy, as a fraction of the initial energy, to be printed out.
+*/
+void SpeckMacModule::enterEnergyTier(int tier, double remaining)
+{
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": energy tier changed from " << energyTier << " to " << tier << " (" << remaining * 100.0 << "% of the energy left)";
+	
+	while ((int) energyTierEntryTimes.size() < tier)
+		energyTierEntryTimes.push_back(simTime());
+	
+	energyTier = tier;
+	advertisedSleepScale = pow(energyTierSleepFactor, tier);
+	listenInterval = baseListenInterval * pow(energyTierListenFactor, tier);
+}
+
+/*!
+	\brief Check whether a network frame of message priority \b priority is refused in the current energy tier.
+	
+	In tier k, the frames of the k least urgent levels of the transmission buffer are refused. Frames of level 0 are always accepted, so a buffer with a single level (queuePriorityLevels = 1) accepts every frame.
+*/
+bool SpeckMacModule::refusedByEnergyTier(int priority)
+{
+	return (energyTier > 0) && (priority > 0) && (priority >= queuePriorityLevels - energyTier);
+}
+
+/*!
+	\brief Set radio state.
+	
+	This method is called when the MAC module requires to change the radio state. Read the radio datasheet to know the time and energy required to switch states.
+ */
+void SpeckMacModule::setRadioState(MAC_ContorlMessageType typeID, double delay)
+{
+	if( (typeID != MAC_2_RADIO_ENTER_SLEEP) && (typeID != MAC_2_RADIO_ENTER_LISTEN) && (typeID != MAC_2_RADIO_ENTER_TX) )
+	{
+		opp_error("MAC attempt to set Radio into an unknown state. ERROR commandID");
+	}
+
+	MAC_ControlMessage * ctrlMsg = new SpeckMacControlMessage(messageName("state command strobe MAC->radio"), typeID);
+
+	sendDelayed(ctrlMsg, delay, "toRadioModule");
+	
+	if (typeID != MAC_2_RADIO_ENTER_LISTEN)
+		clearCCAs = 0; // the radio stops sensing the channel.
+	
+	accountRadioTime(simTime());
+	radioCommandsToAccount.push(simTime() + delay, typeID);
+	modelRadioCommand(typeID, simTime() + delay + radioLinkDelay);
+}
+
+/*!
+	\brief Update the modelled radio state with a state command \b typeID, which takes effect at \b when.
+	
+	The command joins the commands still pending (pendingRadioCommands), as the delayed transmit commands of a train may all be pending at once; each one is applied when it takes effect (see updateModelledRadio()).
+*/
+void SpeckMacModule::modelRadioCommand(int typeID, double when)
+{
+	updateModelledRadio();
+	pendingRadioCommands.push(when, typeID);
+}
+
+/*!
+	\brief Update the modelled radio state when the radio reports the end of a transmission (RADIO_2_MAC_STOPPED_TX): the radio listens again, until the next pending command takes effect.
+*/
+void SpeckMacModule::modelRadioStoppedTx()
+{
+	updateModelledRadio();
+	if (modelledRadioState != MAC_2_RADIO_ENTER_TX)
+		return;
+	
+	modelledRadioState = MAC_2_RADIO_ENTER_LISTEN;
+	carrierSenseValidTime = simTime() + radioDelayForValidCS;
+}
 
-			// put radio to sleep.
-			dutyCycleSleepMsg = new MAC_ControlMessage("put_radio_to_sleep", MAC_SELF_SET_RADIO_SLEEP);
-			scheduleAt(simTime() + DRIFTED_TIME((double) (2 * maxMacFrameSize * 8 / (1000.0 * radioDataRate))), dutyCycleSleepMsg); 	
-			
-			if ( (self == 5) || (self == 6) )
-				CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t="<< simTime() << ": Sleep after " << ( (2 *maxMacFrameSize * 8) / (1000.0 * radioDataRate) );
-		}
+/*!
+	\brief Apply the pending radio commands that have taken effect by now, in the order they take effect. Listening restarts the carrier sense settling time (radioDelayForValidCS), unless the radio is already listening.
+*/
+void SpeckMacModule::updateModelledRadio()
+{
+	while (pendingRadioCommands.due(simTime()))
+	{
+		int typeID = pendingRadioCommands.frontCommand();
+		if ( (typeID == MAC_2_RADIO_ENTER_LISTEN) && (modelledRadioState != MAC_2_RADIO_ENTER_LISTEN) )
+			carrierSenseValidTime = pendingRadioCommands.frontTime() + radioDelayForValidCS;
+		modelledRadioState = typeID;
+		pendingRadioCommands.pop();
 	}
 }
 
 /*!
-	\brief Handles channel free condition.
+	\brief Check whether the radio's carrier sense indication is valid.
 	
-	This method is called if the channel is free. There are two possibilities:
-	\par Check for frames in the medium.
-	In this case, the module performs carrier sense again, if there is time left in the listenInterval to perform another carrier sense. This is a modification to SpeckMAC to deal with packet-based radios. The original implementation on the Prospeckz IIK used the CC2420 radio's stream mode.
-
-	\par Perform CCA to transmit.
-	The node transmits the frame.
-	\todo Consider perform carrier senses before transmitting, in case the earlier carrier senses fell on intervals between successive packets in a redundant data frame send.
-	\bug Sometimes it is possible for two nodes to be perfectly synchronised. This is dealt with by the random offset introduced to MAC_SELF_INITIATE_TX. This is not entirely effective. However, by adding an offset before transmission in the application layer, delivery ratios equal to 100% may be achieved.
- */
-void SpeckMacModule::carrierFree()
+	Outside pdesMode, the radio is asked (RadioModule::isCarrierSenseValid()). In pdesMode, the answer is derived from the modelled radio state, which follows the state commands sent to the radio and its end of transmission notifications, so that the MAC calls no method of another module.
+	\return 1 if the indication is valid; otherwise RADIO_IN_TX_MODE, RADIO_SLEEPING or RADIO_NON_READY, as the radio would return.
+*/
+int SpeckMacModule::carrierSenseValidity()
 {
-	if ( (self == 6) || (self == 5) )
-		CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Carrier Free";
-	if (macState == MAC_STATE_CARRIER_SENSING)
-	{
-		macState = MAC_STATE_DEFAULT;
-
-		if(printStateTransitions)
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_DEFAULT (MAC_SELF_EXIT_CARRIER_SENSE received when MAC_STATE_CARRIER_SENSING) because Carrier is FREE!!";
-		}
-		
-		if (doTx == TRUE) // if pkt to be Txed, schedule a message NOW that will check the Tx buffer for transmission
-		{
-			// This is because the node could be in wakeup state and already performing carrier sense when a message comes through.
-			//if (self == 6)
-			//{
-#ifdef DEBUG
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Retxing";
-#endif
-			//}
-			if ( (dutyCycleWakeupMsg != NULL) && (dutyCycleWakeupMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleWakeupMsg);
-				dutyCycleWakeupMsg = NULL;
-			}
-			if ( (dutyCycleSleepMsg != NULL) && (dutyCycleSleepMsg->isScheduled()) )
-			{
-				cancelAndDelete(dutyCycleSleepMsg);
-				dutyCycleSleepMsg = NULL;
-			}
-			
-			scheduleAt(simTime(), new MAC_ControlMessage("check schedTXBuffer buffer", MAC_SELF_CHECK_TX_BUFFER));
-		}
-		// If not, this was a carrier sense just to see if the medium had packets. It does not; so run another carrier sense.
-		else
-		{
-			double timeLeftListening;
-			timeLeftListening = listenInterval - (simTime() - lastWakeupTime);
-			if (timeLeftListening > (radioDelayForValidCS + CARRIER_SENSE_INTERVAL) ) // If there's time for another carrier sense, do IT!
-			{
-				if ( (self == 5) || (self == 6) )
-					CASTALIA_DEBUG <<"\n[SpeckMAC_"<< self <<"] t=" << simTime() << ": Redo carrier sense";
-				initiateCarrierSense();
-			}
-		}
-	}	
+	if (!pdesMode)
+		return radioModule->isCarrierSenseValid();
+	
+	updateModelledRadio();
 	
-	selfExitCSMsg = NULL; // Cancel the Carrier Sense exit message.
+	if (modelledRadioState == MAC_2_RADIO_ENTER_TX)
+		return RADIO_IN_TX_MODE;
+	if (modelledRadioState == MAC_2_RADIO_ENTER_SLEEP)
+		return RADIO_SLEEPING;
+	if (simTime() < carrierSenseValidTime)
+		return RADIO_NON_READY;
+	return 1;
 }
 
 /*!
-	\brief Sends data to the radio module.
+	\brief Account the time the radio has spent on and asleep, up to \b until.
 	
-	This method is called \b if the channel is free. It is used to transmit the frame at the head of the transmit buffer. The SpeckMAC-D algorithm performs most of its work in this method. It determines the number of frames that can be transmitted in the sleep interval,\b n, and sends \b n \b + \b 1 redundant frames.
-	\todo Get rid of the else condition. It shouldn't happen.
-	\bug Since sleepInterval/packetSize is not always an integer, we round up! This could result in multiple packet receives. But this is easier to deal with, and less harmful than the other possibility - packet loss.
- */
-void SpeckMacModule::sendData()
+	The pending radio state commands (radioCommandsToAccount) are applied in the order they take effect, up to \b until: the time between two of them is added to radioOnTime or radioSleepTime, depending on the state set by the first one. A command sent with a shorter delay than a pending one thus takes effect before it, and is overridden by it. The radio's own state is not queried; the accounting follows the commands sent by the MAC.
+*/
+void SpeckMacModule::accountRadioTime(double until)
 {
-	if (!(BUFFER_IS_EMPTY))
+	for (;;)
 	{
-		if ( (macState == MAC_STATE_TX) || (macState == MAC_STATE_DEFAULT) )
-		{
-			// SEND THE DATA FRAME TO RADIO BUFFER repeatedly; until the buffer is empty.
+		bool commandDue = radioCommandsToAccount.due(until);
+		double when = commandDue ? radioCommandsToAccount.frontTime() : until;
 		
-			MAC_GenericFrame *dataFrame, *dupFrame;
-			dataFrame = popTxBuffer();
-#ifdef STATISTICS				
-			numSent ++;
-#endif	
-			for (int i = 0; i <= redundancy; i++) // Send multiple packets - redundancy + 1. Send them back to back.
-			{
-				dupFrame = (MAC_GenericFrame *)dataFrame->dup();
-				sendDelayed(dupFrame, DRIFTED_TIME(i*dataTXtime) ,"toRadioModule");
-				setRadioState(MAC_2_RADIO_ENTER_TX, DRIFTED_TIME(i*dataTXtime) + epsilon); // Remove epsilon.??
-			}
- 			
-			delete dataFrame;
-			dataFrame = NULL;
-			
-			// If the buffer is still not empty; i.e., the node has more packets to send, sleep for a short period = length of data packet + epsilon, so u restart carrier sense after that
-			
-			// check to see if we must schedule extra transmissions
-		}
-		else 
+		if (when > lastRadioStateChange)
 		{
-			// The application will never enter this, as SELF_CHECK_TX_BUFFER is called only if buffer not empty. But as a safeguard. Doesn't work properly cuz I dont think it matters. ;)
-			
-			macState = MAC_STATE_DEFAULT;
-			if(printStateTransitions)
-			{
-				CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_DEFAULT (MAC_SELF_CHECK_TX_BUFFER received and buffer is empty). ERROR: THIS CODE SHOULD NOT BE EXECUTED.";
-			}
-			setRadioState(MAC_2_RADIO_ENTER_SLEEP); // for a period equal to one guard period, there is no transmission.
-				
-			// dutyCycleWakeupMsg = new MAC_ControlMessage("wake_up_radio", MAC_SELF_WAKEUP_RADIO);
-			// scheduleAt(simTime() + DRIFTED_TIME(sleepInterval), dutyCycleWakeupMsg);
+			if (radioOn)
+				radioOnTime += when - lastRadioStateChange;
+			else
+				radioSleepTime += when - lastRadioStateChange;
 			
+			lastRadioStateChange = when;
 		}
+		
+		if (!commandDue)
+			return;
+		
+		radioOn = (radioCommandsToAccount.frontCommand() != MAC_2_RADIO_ENTER_SLEEP);
+		radioCommandsToAccount.pop();
 	}
 }
 
 /*!
-	\brief Mop-up tasks after data transmission
+	\brief (Re)schedule a persistent self-message.
 	
-	This method is called when the radio module completes transmission, and schedules additional transmissions if necessary. Additional transmissions are carried out after a guard period, to prevent a given node locking the channel.
-	\todo Test with multiple packets per node per try; i.e., at higher data rates.
- */
-void SpeckMacModule::finishDataTransmission()
+	This method cancels the message if it is already scheduled, and schedules it again after \b delay seconds. It is used for all of the persistent self-messages allocated in initialize(), so that no self-message is allocated or deleted during the simulation.
+*/
+void SpeckMacModule::rescheduleSelfMessage(cMessage *msg, double delay)
 {
-	if(macState == MAC_STATE_TX)
-	{
-		macState = MAC_STATE_DEFAULT;
-		if(printStateTransitions)
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": State changed to MAC_STATE_DEFAULT (RADIO_2_MAC_STOPPED_TX received when MAC_STATE_TX); i.e., transmission complete";
-		}
-				
-		CASTALIA_DEBUG << "\n[SpeckMAC_" << self <<"] t= " << simTime() << ": Put radio to sleep till next SELF_INITIATE_TX or WAKEUP";
-								
-		if (!(BUFFER_IS_EMPTY))
-		{
-			CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t= " << simTime() << ": Schedule additional transmissions";
-				// Which is, like, now.
-			
-			scheduleAt(simTime()+ DRIFTED_TIME(dataTXtime + epsilon), new MAC_ControlMessage("check schedTXBuffer buffer", MAC_SELF_INITIATE_TX)); // restart carrier sense after guard period.
-		}
-		else // The buffer is empty.
-		{
-			doTx = FALSE; // Since the buffer is empty, there are no more transmissions to be performed.
-			
-			CASTALIA_DEBUG << "\n[SpeckMAC_"<<self<<"] t= " << simTime() << ": No additional transmissions. Tx complete. Wake up after sleeping for the guard period";
-		}
-	}
+	if (msg->isScheduled())
+		cancelEvent(msg);
 	
-	// Put node to sleep. NOW!
-	setRadioState(MAC_2_RADIO_ENTER_SLEEP);
-	dutyCycleWakeupMsg = new MAC_ControlMessage("wakeup_radio", MAC_SELF_WAKEUP_RADIO);
-	scheduleAt(simTime() + sleepInterval, dutyCycleWakeupMsg);
+	scheduleAt(simTime() + delay, msg);
 }
+
 /*!
-	\brief Reads parameters from the ini file.
-	
-	This method is called when the MAC module initialises. It loads parameters from the .ini file, into the appropriate class members.
- */
-void SpeckMacModule::readIniFileParameters()
+	\brief Cancel a persistent self-message, if it is scheduled. The message is not deleted.
+*/
+void SpeckMacModule::cancelSelfMessage(cMessage *msg)
 {
-	printDebugInfo = par("printDebugInfo");
-	printStateTransitions = par("printStateTransitions");
-	
-	sleepInterval = par("sleepInterval");
-	listenInterval = par("listenInterval");
-	randomTxOffset = par("randomTxOffset");
-	
-	maxMacFrameSize = par("maxMacFrameSize");
-	macBufferSize = par("macBufferSize");
-	macFrameOverhead = par("macFrameOverhead");
+	if (msg->isScheduled())
+		cancelEvent(msg);
 }
 
 /*!
-	\brief Set radio state.
+	\brief Handle a self-message for the current time.
 	
-	This method is called when the MAC module requires to change the radio state. Read the radio datasheet to know the time and energy required to switch states.
- */
-void SpeckMacModule::setRadioState(MAC_ContorlMessageType typeID, double delay)
+	With inlineZeroDelayHops, the message is handled straight away, as if it had been delivered by the simulation kernel (see handleMessage()), instead of going through the future event set. Otherwise, or if maxInlineDepth messages are already being handled inline, it is scheduled for the current time.
+	Handling the message inline moves it ahead of the other events of the current time, so this is only used where the message is the last action of its handler, and only if no message for the current time has been sent to another module in the current event (lastSendEvent): that message would otherwise arrive after the hop instead of before it. A carrier sense inlined after the command that wakes the radio up, for instance, would find the radio still asleep. The message is either a persistent self-message, which is cancelled first if scheduled, or a message owned by the module.
+*/
+void SpeckMacModule::postSelfMessage(cMessage *msg)
 {
-	if( (typeID != MAC_2_RADIO_ENTER_SLEEP) && (typeID != MAC_2_RADIO_ENTER_LISTEN) && (typeID != MAC_2_RADIO_ENTER_TX) )
+	cancelSelfMessage(msg);
+	
+	if (!inlineZeroDelayHops || (inlineDepth >= maxInlineDepth) || (lastSendEvent == simulation.eventNumber()))
 	{
-		opp_error("MAC attempt to set Radio into an unknown state. ERROR commandID");
+		scheduleAt(simTime(), msg);
+		return;
 	}
+	
+	inlinedHops++;
+#ifdef SPECKMAC_PROFILE
+	eventProfile[isDroppedWhileDisabled(msg->kind()) ? MAC_EVENT_UNKNOWN : eventOf(msg->kind())].inlined++;
+#endif
+	inlineDepth++;
+	handleMessage(msg);
+	inlineDepth--;
+}
 
-	MAC_ControlMessage * ctrlMsg = new MAC_ControlMessage("state command strobe MAC->radio", typeID);
-
-	sendDelayed(ctrlMsg, delay, "toRadioModule");
+/*!
+	\brief Check if the message is one of the persistent self-messages owned by the module.
+*/
+bool SpeckMacModule::isPersistentSelfMessage(cMessage *msg)
+{
+	return ( (msg == dutyCycleSleepMsg) || (msg == dutyCycleWakeupMsg) || (msg == performCSMsg) || (msg == selfExitCSMsg) || (msg == checkTxBufferMsg) || (msg == initiateTxMsg) || (msg == ackTimeoutMsg) );
 }
 
 /*!
 	\brief Obtain frame at the head of the transmission buffer.
 	
-	This method is called when the MAC module requires to obtain a frame from the queue, and schedule it for transmission to the radio module. It also calculates the time taken to transmit the frame, and the number of redundant copies to be sent.
+	This method is called when the MAC module requires to obtain a frame from the queue, and schedule it for transmission to the radio module. It also looks up the time taken to transmit the frame, and the number of redundant copies to be sent (see precomputeFrameTimings()).
+	The frame is taken from the most urgent non-empty level of the buffer. Frames whose deadline has passed are dropped on the way, so that no airtime is spent on them; the method returns NULL if no other frame is left.
 	
-	\note Rounding is done to the next highest integer.
+	\param aggregate
+	Move the network frames of the frames that follow it in the queue into the frame, for as long as canAggregate() allows it. Only sendData() aggregates (with aggregateFrames set); a frame popped to be dropped is dropped on its own.
  */
 
-MAC_GenericFrame* SpeckMacModule::popTxBuffer()
+SpeckMacFrame* SpeckMacModule::popTxBuffer(bool aggregate)
 {
-	if (tailTxBuffer == headTxBuffer) 
+	if (schedTXBuffer.empty()) 
 	{
 		ev << "\nTrying to pop  EMPTY TxBuffer!!";
-		tailTxBuffer--;  // reset tail pointer
 		return NULL;
 	}
 	
-	MAC_GenericFrame* dataFrame = NULL;
+	SpeckMacFrame* dataFrame = NULL;
+	
+	while ( (dataFrame == NULL) && !schedTXBuffer.empty() )
+	{
+		dataFrame = schedTXBuffer.pop();
+		if (dataFrame->isExpired(simTime()))
+		{
+			dropExpiredFrame(dataFrame);
+			dataFrame = NULL;
+		}
+	}
+	
+	// Pay for the carrier sense and the redundant copies once for the whole burst.
+	while ( (dataFrame != NULL) && aggregate && !schedTXBuffer.empty() )
+	{
+		SpeckMacFrame *nextFrame = schedTXBuffer.front();
+		if (nextFrame->isExpired(simTime()))
+		{
+			dropExpiredFrame(schedTXBuffer.pop());
+			continue;
+		}
+		if (!canAggregate(dataFrame, nextFrame))
+			break;
+		
+		schedTXBuffer.pop();
+		dataFrame->aggregate(nextFrame);
+		delete nextFrame;
+		aggregatedFrames++;
+	}
+	
+	if (recordVectors)
+		txBufferVector.record(schedTXBuffer.size());
 	
-	dataFrame = schedTXBuffer[headTxBuffer];
+	if (dataFrame == NULL)
+		return NULL;
 	
-	dataTXtime = ((double)(dataFrame->byteLength()+phyLayerOverhead) * 8.0 / (1000.0 * radioDataRate));
- 
-	redundancy = (int)( (sleepInterval / dataTXtime) + 0.5); // to round it off to the next highest integer.
+	int frameLength = dataFrame->byteLength(); // never larger than maxMacFrameSize; see encapsulateNetworkFrame().
+	dataTXtime = txTimeByLength[frameLength];
+	redundancy = redundancyByLength[frameLength];
 	CASTALIA_DEBUG <<  "\n[SpeckMAC_"<<self<<"] t = "<< simTime() <<": Redundancy = "<< redundancy;
-	headTxBuffer = (++headTxBuffer)%(MAC_BUFFER_ARRAY_SIZE);
 	
 	return dataFrame;
 }
 
+/*!
+	\brief Decide whether the network frames of \b nextFrame may be sent in \b dataFrame.
+	
+	\return true if both frames have the same destination, and the aggregated frame would not be longer than maxMacFrameSize.
+*/
+bool SpeckMacModule::canAggregate(SpeckMacFrame *dataFrame, SpeckMacFrame *nextFrame)
+{
+	if (nextFrame->getHeader().destID != dataFrame->getHeader().destID)
+		return false;
+	
+	return (dataFrame->byteLength() + nextFrame->payloadLength()) <= maxMacFrameSize;
+}
+
+/*!
+	\brief Drop a frame popped from the transmission buffer because its deadline has passed.
+*/
+void SpeckMacModule::dropExpiredFrame(SpeckMacFrame *dataFrame)
+{
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": Frame expired at t= " << dataFrame->getDeadline() << " dropped from the TX buffer";
+	delete dataFrame;
+	expiredDrops++;
+}
+
+/*!
+	\brief Make room in the full transmission buffer for \b dataFrame (bufferFullPolicy = "dropOldest").
+	
+	The oldest frame of the least urgent non-empty level is evicted, unless that level is more urgent than the level of \b dataFrame; the new frame is then dropped instead.
+	\return true if a frame was evicted.
+*/
+bool SpeckMacModule::evictForFrame(SpeckMacFrame *dataFrame)
+{
+	unsigned int level = schedTXBuffer.lastLevel();
+	unsigned int newLevel = dataFrame->getTxPriority();
+	
+	if (newLevel >= schedTXBuffer.levelCount())
+		newLevel = schedTXBuffer.levelCount() - 1;
+	if (level < newLevel)
+		return false;
+	
+	SpeckMacFrame *oldFrame = schedTXBuffer.popLevel(level);
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": SchedTxBuffer FULL; evicting the oldest frame of level " << level;
+	delete oldFrame;
+	bufferFullEvictions++;
+	return true;
+}
+
 /*!
 	\brief Get the size of the transmission buffer.
 */
 int SpeckMacModule::getTXBufferSize(void)
 {
-	int size = tailTxBuffer - headTxBuffer;
-	if ( size < 0 )
-		size += MAC_BUFFER_ARRAY_SIZE;
-
-	return size;
+	return schedTXBuffer.size();
 }
 
 /*!
 	\brief Push frame into buffer.
 	
-	Create a copy of the MAC frame generated from the received network packet, and push it into the buffer.
+	Push the MAC frame generated from the received network packet into the buffer. The frame itself is pushed; no copy is made. If the frame cannot be pushed, it is deleted. If the buffer is full and dropOldestWhenFull is set, a frame is evicted first (see evictForFrame()).
 */
 void SpeckMacModule::pushFrameIntoBuffer(cMessage *msg)
 {
-	if(!(BUFFER_IS_FULL))
+	SpeckMacFrame *dataFrame = check_and_cast<SpeckMacFrame*>(msg);
+	
+	if (schedTXBuffer.full() && dropOldestWhenFull)
+		evictForFrame(dataFrame);
+	
+	if(!schedTXBuffer.full())
 	{
 		// CASTALIA_DEBUG << "[SpeckMAC_" << self << "] t=" << simTime() << ": Pushing frame into buffer\n";
-		MAC_GenericFrame *dataFrame = check_and_cast<MAC_GenericFrame*>(msg);
-
-				// create a new copy of the message because dataFrame will be deleted outside the switch statement
-		MAC_GenericFrame *duplMsg = (MAC_GenericFrame *)dataFrame->dup(); //because theFrame will be deleted after the main switch in the handleMessage()
-		pushBuffer(duplMsg);
-		
+		if (!pushBuffer(dataFrame))
+		{
+			delete dataFrame;
+			bufferFullDrops++;
+		}
 	}
 	else
 	{
-		MAC_ControlMessage *fullBuffMsg = new MAC_ControlMessage("MAC buffer is full Radio->Mac", MAC_2_NETWORK_FULL_BUFFER);
+		delete dataFrame;
+		bufferFullDrops++;
+		
+		MAC_ControlMessage *fullBuffMsg = new SpeckMacControlMessage(messageName("MAC buffer is full Radio->Mac"), MAC_2_NETWORK_FULL_BUFFER);
 
 		send(fullBuffMsg, "toNetworkModule");
 				
@@ -942,7 +2047,7 @@ void SpeckMacModule::pushFrameIntoBuffer(cMessage *msg)
 /*!
 	\brief Push frame into the transmission buffer.
 */
-int SpeckMacModule::pushBuffer(MAC_GenericFrame *theFrame)
+int SpeckMacModule::pushBuffer(SpeckMacFrame *theFrame)
 {
 	if(theFrame == NULL)
 	{
@@ -950,42 +2055,26 @@ int SpeckMacModule::pushBuffer(MAC_GenericFrame *theFrame)
 		return 0;
 	}
 
-	tailTxBuffer = (++tailTxBuffer)%(MAC_BUFFER_ARRAY_SIZE); //increment the tailTxBuffer pointer. If reached the end of array, then start from position [0] of the array
-
-	if (tailTxBuffer == headTxBuffer)
+	theFrame->setKind(MAC_FRAME);
+	
+	if (!schedTXBuffer.push(theFrame, theFrame->getTxPriority()))
 	{
-		// reset tail pointer
-		if(tailTxBuffer == 0)
-		{
-			tailTxBuffer = MAC_BUFFER_ARRAY_SIZE-1;
-		}
-		else
-		{
-			tailTxBuffer--;
-		}
 		CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": WARNING: SchedTxBuffer FULL!!! value to be Tx not added to buffer\n";
 		return 0;
 	}
-
-	
-	theFrame->setKind(MAC_FRAME);
 	
-	if (tailTxBuffer==0)
-	{
-		schedTXBuffer[MAC_BUFFER_ARRAY_SIZE-1] = theFrame;
-	}
-	else
-	{
-		schedTXBuffer[tailTxBuffer-1] = theFrame;
-	}
+	if (recordVectors)
+		txBufferVector.record(schedTXBuffer.size());
 	
 	return 1;
 }
 
 /*!
 	\brief Encapsulates the network frame into a MAC frame.
+	
+	The network frame is attached to the MAC frame as a shared payload, without being copied. If encapsulation fails, the network frame is left untouched.
  */
-int SpeckMacModule::encapsulateNetworkFrame(Network_GenericFrame *networkFrame, MAC_GenericFrame *retFrame)
+int SpeckMacModule::encapsulateNetworkFrame(Network_GenericFrame *networkFrame, SpeckMacFrame *retFrame)
 {
 	int totalMsgLen = networkFrame->byteLength() + macFrameOverhead;
 	if(totalMsgLen > maxMacFrameSize)
@@ -997,28 +2086,298 @@ int SpeckMacModule::encapsulateNetworkFrame(Network_GenericFrame *networkFrame,
 	retFrame->getHeader().destID = resolvDestination(networkFrame->getHeader().destCtrl.c_str());
 	
 	retFrame->getHeader().frameType = MAC_PROTO_DATA_FRAME;
+	
+	retFrame->setSeqNum(nextSeqNum++);
 
-	Network_GenericFrame *dupNetworkFrame = check_and_cast<Network_GenericFrame *>(networkFrame->dup());
-	retFrame->encapsulate(dupNetworkFrame);
+	drop(networkFrame); // the payload now owns the network frame.
+	retFrame->attachPayload(networkFrame);
 
 	return 1;
 }
 
+/*!
+	\brief Obtain the MAC address of the destination of a network frame, from its destCtrl field.
+	
+	The destination is parsed once, in place; no string is built.
+*/
 int SpeckMacModule::resolvDestination(const char *routingDestination)
 {
-	string tmpParDestination(routingDestination);
-	char buff[256];
+	// The broadcast address is written as BROADCAST_ADDR in decimal, so it parses to BROADCAST_ADDR like any other node ID.
+	return atoi(routingDestination);
+}
+
+/*!
+	\brief Pack or unpack \b value, depending on \b packing, so that a single list of fields serves both directions (see SpeckMacModule::transferState()).
+*/
+template <class T>
+static void transfer(cCommBuffer *b, bool packing, T &value)
+{
+	if (packing)
+		b->pack(value);
+	else
+		b->unpack(value);
+}
+
+/*!
+	\brief Save the state of the module to \b fileName.<node ID>.
+	
+	The file holds checkpointMagic, the size of the state in bytes, and the state packed by transferState(). Nothing is written to the file if the state cannot be packed.
+*/
+void SpeckMacModule::saveCheckpoint(const char *fileName)
+{
+	char nodeSuffix[16];
+	sprintf(nodeSuffix, ".%d", self);
+	string path = string(fileName) + nodeSuffix;
+	
+	cMemCommBuffer buffer;
+	transferState(&buffer, true);
+	int size = buffer.getMessageSize();
+	
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		opp_error("\n[Mac]:\n Cannot open the checkpoint file \"%s\" for writing.", path.c_str());
+	
+	bool written = (fwrite(checkpointMagic, 1, sizeof(checkpointMagic), file) == sizeof(checkpointMagic))
+		&& (fwrite(&size, sizeof(size), 1, file) == 1)
+		&& (fwrite(buffer.getBuffer(), 1, size, file) == (size_t) size);
+	if ( (fclose(file) != 0) || !written )
+		opp_error("\n[Mac]:\n Cannot write the checkpoint file \"%s\".", path.c_str());
+	
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": state saved to " << path << " (" << size << " bytes)";
+}
+
+/*!
+	\brief Restore the state of the module from \b fileName.<node ID>, written by saveCheckpoint().
+	
+	This is done at the end of initialize(), once the parameters have been read and the persistent self-messages allocated. The parameters of the run (buffer size, timings, ...) are those of the new run; only the state is restored. A file from another version of the module is rejected.
+*/
+void SpeckMacModule::restoreCheckpoint(const char *fileName)
+{
+	char nodeSuffix[16];
+	sprintf(nodeSuffix, ".%d", self);
+	string path = string(fileName) + nodeSuffix;
+	
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		opp_error("\n[Mac]:\n Cannot open the checkpoint file \"%s\".", path.c_str());
+	
+	char magic[sizeof(checkpointMagic)];
+	int size = 0;
+	cMemCommBuffer buffer;
+	bool valid = (fread(magic, 1, sizeof(magic), file) == sizeof(magic))
+		&& (memcmp(magic, checkpointMagic, sizeof(magic)) == 0)
+		&& (fread(&size, sizeof(size), 1, file) == 1)
+		&& (size >= 0);
+	if (valid)
+	{
+		buffer.allocateAtLeast(size);
+		valid = (fread(buffer.getBuffer(), 1, size, file) == (size_t) size);
+		buffer.setMessageSize(size);
+	}
+	fclose(file);
+	
+	if (!valid)
+		opp_error("\n[Mac]:\n \"%s\" is not a SpeckMAC checkpoint of this version, or is truncated.", path.c_str());
+	
+	transferState(&buffer, false);
+	if (!buffer.isBufferEmpty())
+		opp_error("\n[Mac]:\n The checkpoint \"%s\" holds more state than this version of SpeckMAC restores.", path.c_str());
+	
+	resumeRestoredState();
+	
+	CASTALIA_DEBUG << "\n[SpeckMAC_" << self << "] t= " << simTime() << ": state restored from " << path << " in " << macStateNames[macState] << ", " << schedTXBuffer.size() << " frames queued";
+}
+
+/*!
+	\brief Pack (\b packing) or unpack the state of the module into \b b.
+	
+	Each field is listed once, for both directions, so that the layout of a checkpoint cannot differ between saving and restoring; checkpointMagic must be changed whenever the list changes.
+	Times are packed relative to the current time: a run restored at time 0 sees every pending self-message, deadline and past event at the same distance as when the state was saved. The counters are restored too, so that the scalars recorded by a restored run include the run it was forked from.
+	The frames of the transmission buffer are packed with their payloads (see SpeckMacFrame::netPack()), most urgent level first, and pushed again at their own level when unpacked.
+	The drift and the wander of the local clock come from the parameters; its phase and skew are restored.
+	\note The random number streams, the back-off policy, the sequence cache, and frames held by the radio or by a pending MAC_FRAME_SELF_PUSH_TX_BUFFER message, are not part of the state.
+*/
+void SpeckMacModule::transferState(cCommBuffer *b, bool packing)
+{
+	transfer(b, packing, macState);
+	transfer(b, packing, disabled);
+	transfer(b, packing, shutDown);
+	transferTime(b, packing, shutDownTime);
+	transfer(b, packing, doTx);
+	transfer(b, packing, nextSeqNum);
+	transfer(b, packing, redundancy);
+	transfer(b, packing, dataTXtime);
+	transfer(b, packing, sleepInterval);
+	transfer(b, packing, trainCoverInterval);
+	transfer(b, packing, advertisedSleepInterval);
+	transfer(b, packing, neighbourSleepInterval);
+	transfer(b, packing, idleCycles);
+	transfer(b, packing, consecutiveBusyCCAs);
+	transfer(b, packing, pendingPhaseShift);
+	transfer(b, packing, clearCCAs);
+	transfer(b, packing, radioOn);
+	if (!packing)
+	{
+		radioCommandsToAccount.clear(); // the radio of this run has not received them.
+		pendingRadioCommands.clear();
+	}
+	transfer(b, packing, radioOnTime);
+	transfer(b, packing, radioSleepTime);
+	transfer(b, packing, energyTier);
+	transfer(b, packing, energySleepScale);
+	transfer(b, packing, advertisedSleepScale);
+	transfer(b, packing, listenInterval);
+	transferTime(b, packing, nextEnergyCheck);
 	
-	sprintf(buff, "%i" , BROADCAST_ADDR);
-	string broadcastAddr(buff);
+	int numTierEntries = energyTierEntryTimes.size();
+	transfer(b, packing, numTierEntries);
+	energyTierEntryTimes.resize(numTierEntries);
+	for (int i = 0; i < numTierEntries; i++)
+		transferTime(b, packing, energyTierEntryTimes[i]);
+	
+	transferTime(b, packing, lastWakeupTime);
+	transferTime(b, packing, trainEndTime);
+	transferTime(b, packing, clearCCAsStart);
+	transferTime(b, packing, lastRadioStateChange);
+	
+	// The clock resumes its wander where it was: the phase is packed as of now, and the skew holds until its next update.
+	double clockPhase = localClock.phaseAt(simTime());
+	double clockSkew = localClock.currentSkew();
+	double clockUpdate = localClock.nextUpdateTime();
+	transfer(b, packing, clockPhase);
+	transfer(b, packing, clockSkew);
+	transferTime(b, packing, clockUpdate);
+	if (!packing)
+		localClock.restore(clockPhase, clockSkew, clockUpdate, simTime());
+	
+	long *counters[] =
+	{
+		&framesSent, &copiesSent, &acksSent, &acksReceived, &copiesSaved, &framesReceived, &duplicatesDropped, &overheardDropped,
+		&carrierBusyCount, &busyWhileTx, &busyWhileListening, &aggregatedFrames, &deferredWakeups, &sleepIntervalChanges, &rephases, &earlySleeps,
+		&rxFailed, &bufferFullDrops, &oversizedDrops, &busyDrops, &inlinedHops, &expiredDrops, &bufferFullEvictions, &framesReceivedAtAdaptation,
+		&rejectedEvents, &energyTierDrops, &shutDownDrops
+	};
+	for (unsigned int i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+		transfer(b, packing, *counters[i]);
+	for (int from = 0; from < MAC_STATE_COUNT; from++)
+		for (int to = 0; to < MAC_STATE_COUNT; to++)
+			transfer(b, packing, transitionCounts[from][to]);
 	
+	cMessage *selfMessages[] = {dutyCycleSleepMsg, dutyCycleWakeupMsg, performCSMsg, selfExitCSMsg, checkTxBufferMsg, initiateTxMsg, ackTimeoutMsg};
+	for (unsigned int i = 0; i < sizeof(selfMessages) / sizeof(selfMessages[0]); i++)
+	{
+		bool scheduled = selfMessages[i]->isScheduled();
+		double fireTime = scheduled ? (double) selfMessages[i]->arrivalTime() : simTime();
+		transfer(b, packing, scheduled);
+		transferTime(b, packing, fireTime);
+		
+		if (!packing && scheduled)
+			rescheduleSelfMessage(selfMessages[i], (fireTime > simTime()) ? fireTime - simTime() : 0.0);
+	}
 	
-	if(tmpParDestination.compare(broadcastAddr) == 0)
+	int numFrames = schedTXBuffer.size();
+	transfer(b, packing, numFrames);
+	if (packing)
+	{
+		for (unsigned int level = 0; level < schedTXBuffer.levelCount(); level++)
+			for (unsigned int i = 0; i < schedTXBuffer.levelSize(level); i++)
+				transferFrame(b, true, schedTXBuffer.at(level, i));
+	}
+	else
 	{
-		return BROADCAST_ADDR;
+		for (int i = 0; i < numFrames; i++)
+		{
+			SpeckMacFrame *frame = NULL;
+			transferFrame(b, false, frame);
+			if (!schedTXBuffer.push(frame, frame->getTxPriority()))
+			{
+				bufferFullDrops++; // the buffer of this run is smaller.
+				delete frame;
+			}
+		}
 	}
+	
+	bool hasTrainFrame = (trainFrame != NULL);
+	transfer(b, packing, hasTrainFrame);
+	if (hasTrainFrame)
+		transferFrame(b, packing, trainFrame);
+	transfer(b, packing, trainCopiesSent);
+	transfer(b, packing, trainAwaitsAck);
+}
+
+/*!
+	\brief Pack or unpack a time, relative to the current time (see transferState()).
+*/
+void SpeckMacModule::transferTime(cCommBuffer *b, bool packing, double &time)
+{
+	double relativeTime = time - simTime();
+	transfer(b, packing, relativeTime);
+	if (!packing)
+		time = relativeTime + simTime();
+}
+
+/*!
+	\brief Pack or unpack a frame, with its deadline relative to the current time; \b frame is allocated when unpacking.
+	
+	A frame that does not expire keeps a deadline of 0. A frame that had expired when its state was saved gets a deadline of epsilon, so that it is dropped on its first pop instead of never expiring.
+*/
+void SpeckMacModule::transferFrame(cCommBuffer *b, bool packing, SpeckMacFrame *&frame)
+{
+	if (packing)
+		b->packObject(frame);
 	else
+		frame = check_and_cast<SpeckMacFrame *>(b->unpackObject());
+	
+	double deadline = frame->getDeadline();
+	bool expires = (deadline > 0.0);
+	transfer(b, packing, expires);
+	transferTime(b, packing, deadline);
+	
+	if (!packing)
+		frame->setDeadline(expires ? ((deadline > epsilon) ? deadline : epsilon) : 0.0);
+}
+
+/*!
+	\brief Bring the restored state in line with the radio of this run, which has just been put to sleep by initialize().
+	
+	A transmission, carrier sense or reception in progress when the state was saved cannot be carried on: the frame being sent is queued again, the pending steps of the operation are cancelled, and a transmission of the queued frames is initiated, from MAC_STATE_DEFAULT. The radio is then switched to the state it was last commanded to; its carrier sense settles again, as after any wakeup.
+	A running node is always left with a duty cycle message scheduled: the operations interrupted in MAC_STATE_TRY_TX or MAC_STATE_CARRIER_SENSING had cancelled both, and would otherwise never have scheduled them again.
+	\note Copies of a frame already handed to the radio (outside txTrainMode) are lost with the radio's state.
+*/
+void SpeckMacModule::resumeRestoredState()
+{
+	restored = true;
+	precomputeRedundancies();
+	
+	if ( (macState != MAC_STATE_DEFAULT) || (trainFrame != NULL) )
 	{
-		return atoi(routingDestination);
+		if (trainFrame != NULL)
+		{
+			if (!schedTXBuffer.push(trainFrame, trainFrame->getTxPriority()))
+			{
+				bufferFullDrops++;
+				delete trainFrame;
+			}
+			trainFrame = NULL;
+		}
+		trainCopiesSent = 0;
+		trainAwaitsAck = false;
+		
+		cancelSelfMessage(performCSMsg);
+		cancelSelfMessage(selfExitCSMsg);
+		cancelSelfMessage(checkTxBufferMsg);
+		cancelSelfMessage(initiateTxMsg);
+		cancelSelfMessage(ackTimeoutMsg);
+		
+		macState = MAC_STATE_DEFAULT;
+		doTx = schedTXBuffer.empty() ? FALSE : TRUE; // the carrier sense of the new initiation is a CCA for the queued frames.
+		if (doTx == TRUE)
+			rescheduleSelfMessage(initiateTxMsg);
 	}
+	
+	// initiateTransmission() cancels the wakeup again, so it only takes over if the transmission is deferred or refused.
+	if ( (disabled == FALSE) && !dutyCycleWakeupMsg->isScheduled() && !dutyCycleSleepMsg->isScheduled() )
+		rescheduleSelfMessage(dutyCycleWakeupMsg, initiateTxMsg->isScheduled() ? localToSim(sleepInterval * energySleepScale) : 0.0);
+	
+	setRadioState(radioOn ? MAC_2_RADIO_ENTER_LISTEN : MAC_2_RADIO_ENTER_SLEEP);
 }
@@ -8,7 +8,11 @@
 #define SPECKMACMODULE
 
 #include <vector>
+#include <cmath>
 #include <omnetpp.h>
+#ifdef SPECKMAC_PROFILE
+#include <time.h>
+#endif
 //#include "App_GenericDataPacket_m.h"
 #include "App_ControlMessage_m.h"
 #include "NetworkGenericFrame_m.h"
@@ -19,31 +23,62 @@
 #include "ResourceGenericManager.h"
 #include "RadioModule.h"
 #include "DebugInfoWriter.h"
+#include "SpeckMacFrame.h"
+#include "SpeckMacControlMessage.h"
+#include "RingBuffer.h"
+#include "MultiLevelQueue.h"
+#include "SequenceCache.h"
+#include "BackoffPolicy.h"
+#include "BinaryTrace.h"
+#include "LocalClock.h"
+#include "RadioCommandQueue.h"
 using namespace std;
 
 #define TRUE 1 
 
 #define FALSE 0
 
-#define MAC_BUFFER_ARRAY_SIZE macBufferSize+1 //!< \def Define size of the transmit buffer.
+#define CARRIER_SENSE_INTERVAL 0.0001 //!< \def Interval for which radio performs Carrier Sense.
 
-#define BUFFER_IS_EMPTY  (headTxBuffer==tailTxBuffer) //!< \def Macro to check if buffer is empty.
 
-#define BUFFER_IS_FULL  (getTXBufferSize() >= macBufferSize) //!< \def Macro to check if buffer is full.
+// #define SPECKMAC_PROFILE //!< \def Compile in the event profiler: the count, handler time and messages spawned of each event are recorded in finish(). Needs clock_gettime() (link with -lrt on older systems).
 
-#define CARRIER_SENSE_INTERVAL 0.0001 //!< \def Interval for which radio performs Carrier Sense.
+#define EV   ev.disabled() ? (ostream&)ev : ev //!< \def Output to Primary-Output.txt
 
-#define DRIFTED_TIME(time) ((time) * cpuClockDrift)
+#define SPECKMAC_LOG_NONE 0 //!< \def Log level: no debug output is compiled in.
 
-#define EV   ev.disabled() ? (ostream&)ev : ev //!< \def Output to Primary-Output.txt
+#define SPECKMAC_LOG_DEBUG 1 //!< \def Log level: debug information (CASTALIA_DEBUG) is compiled in.
 
-#define SLEEP 0 
+#define SPECKMAC_LOG_TRACE 2 //!< \def Log level: debug information, and per-node traces (SPECKMAC_TRACE) are compiled in.
 
-#define WAKEUP 1
+#ifndef SPECKMAC_LOG_LEVEL
+#define SPECKMAC_LOG_LEVEL SPECKMAC_LOG_TRACE //!< \def Compile-time log level. Override with -DSPECKMAC_LOG_LEVEL=... in the Makefile.
+#endif
 
-#define CASTALIA_DEBUG (!printDebugInfo)?(ostream&)DebugInfoWriter::getStream():DebugInfoWriter::getStream() //!< \def Macro to print debug information.
+// The operands of a disabled log statement are never evaluated: the stream expression is the body of a loop that runs at most once. The guard has no else branch, so the macros may be used anywhere a statement can.
+#define SPECKMAC_LOG_IF(enabled) for (bool speckmacLogPending = (enabled); speckmacLogPending; speckmacLogPending = false) DebugInfoWriter::getStream() //!< \def Stream to DebugInfoWriter if \b enabled.
 
-// #define STATISTICS //!< \def Enable statistics calculation.
+#if SPECKMAC_LOG_LEVEL >= SPECKMAC_LOG_DEBUG
+#define CASTALIA_DEBUG SPECKMAC_LOG_IF(printDebugInfo) //!< \def Macro to print debug information.
+#else
+#define CASTALIA_DEBUG SPECKMAC_LOG_IF(false)
+#endif
+
+#if SPECKMAC_LOG_LEVEL >= SPECKMAC_LOG_TRACE
+#define SPECKMAC_TRACE SPECKMAC_LOG_IF(printDebugInfo && traceThisNode) //!< \def Macro to print traces for the nodes listed in the traceNodes parameter.
+#else
+#define SPECKMAC_TRACE SPECKMAC_LOG_IF(false)
+#endif
+
+/*!
+	\enum
+	\brief Message kinds and frame types used only by SpeckMAC-D, in addition to those defined by Castalia.
+*/
+enum SpeckMacMessageKinds
+{
+	SPECKMAC_SELF_ACK_TIMEOUT = 2300, //!< The sender of a unicast train did not receive an early ack after a copy.
+	SPECKMAC_ACK_FRAME = 2310 //!< Frame type of an early ack.
+};
 
 /*!
 	\enum
@@ -51,11 +86,37 @@ using namespace std;
 */
 enum MacStates
 {
-	MAC_STATE_DEFAULT = 2204,
-	MAC_STATE_TX = 2205,
-	MAC_STATE_CARRIER_SENSING = 2206,
-	MAC_STATE_EXPECTING_RX = 2207, // because of the duty cycle there is a mode when we are expecting a train of beacons and data
-	MAC_STATE_TRY_TX = 2208
+	MAC_STATE_DEFAULT = 0,
+	MAC_STATE_TX,
+	MAC_STATE_CARRIER_SENSING,
+	MAC_STATE_EXPECTING_RX, // because of the duty cycle there is a mode when we are expecting a train of beacons and data
+	MAC_STATE_TRY_TX,
+	MAC_STATE_COUNT //!< Number of states; the rows of the transition table.
+};
+
+/*!
+	\enum
+	\brief Defines the events that drive the SpeckMAC-D state machine; each corresponds to one message kind handled by the module.
+*/
+enum MacEvents
+{
+	MAC_EVENT_NODE_STARTUP = 0, // APP_NODE_STARTUP
+	MAC_EVENT_SLEEP, // MAC_SELF_SET_RADIO_SLEEP
+	MAC_EVENT_WAKEUP, // MAC_SELF_WAKEUP_RADIO
+	MAC_EVENT_NET_FRAME, // NET_FRAME
+	MAC_EVENT_PUSH_TX_BUFFER, // MAC_FRAME_SELF_PUSH_TX_BUFFER
+	MAC_EVENT_INITIATE_TX, // MAC_SELF_INITIATE_TX
+	MAC_EVENT_PERFORM_CARRIER_SENSE, // MAC_SELF_PERFORM_CARRIER_SENSE
+	MAC_EVENT_CARRIER_BUSY, // RADIO_2_MAC_SENSED_CARRIER
+	MAC_EVENT_CARRIER_FREE, // MAC_SELF_EXIT_CARRIER_SENSE
+	MAC_EVENT_CHECK_TX_BUFFER, // MAC_SELF_CHECK_TX_BUFFER
+	MAC_EVENT_STARTED_TX, // RADIO_2_MAC_STARTED_TX
+	MAC_EVENT_STOPPED_TX, // RADIO_2_MAC_STOPPED_TX
+	MAC_EVENT_FRAME_RECEIVED, // MAC_FRAME
+	MAC_EVENT_OUT_OF_ENERGY, // RESOURCE_MGR_OUT_OF_ENERGY
+	MAC_EVENT_ACK_TIMEOUT, // SPECKMAC_SELF_ACK_TIMEOUT
+	MAC_EVENT_COUNT, //!< Number of events; the columns of the transition table.
+	MAC_EVENT_UNKNOWN = MAC_EVENT_COUNT //!< Message kinds the module does not handle.
 };
 
 /*!
@@ -77,67 +138,280 @@ class SpeckMacModule : public cSimpleModule
 		
 		bool printDebugInfo;  //!< Indicate whether debug information must be printed out.
 		bool printStateTransitions; //!< Indicate whether state transitions should be printed out.
+		BinaryTraceWriter *binaryTrace; //!< The binary trace of the state transitions, shared by all the nodes; NULL if traceFile is empty.
+		int currentEvent; //!< The event being handled, recorded in the binary trace; MAC_EVENT_UNKNOWN outside the event handlers.
+		bool promiscuous; //!< Pass unicast frames addressed to other nodes to the network layer too.
+		bool nameFrames; //!< Indicate whether data frames are named after the time they were created, and the other messages the module sends carry a name (for debugging); otherwise they are unnamed, and no name is copied into each of them.
+		bool traceThisNode; //!< Indicate whether this node is listed in the traceNodes parameter (a space-separated list of node IDs, or "*" for all nodes).
 		
 		double sleepInterval; //!< interval for which the radio is put to sleep.
 		double listenInterval; //!< interval for which the radio is turned on.
-		double randomTxOffset; //!< random offset to get nodes out of sync. \bug Not entirely effective.
+		bool adaptiveDutyCycle; //!< Adapt sleepInterval to the observed traffic, between minSleepInterval and maxSleepInterval.
+		double minSleepInterval; //!< Shortest sleep interval of the adaptive duty cycle.
+		double maxSleepInterval; //!< Longest sleep interval of the adaptive duty cycle.
+		int idleCyclesToLengthen; //!< Number of duty cycles without traffic after which the adaptive duty cycle doubles sleepInterval.
+		
+		// Energy tiers: the node degrades its service in steps as its battery drains (see checkEnergyTier()).
+		vector<double> energyTierThresholds; //!< Fractions of the initial energy, in decreasing order, below which the node enters tiers 1, 2, ...; empty if energy tiers are disabled.
+		double energyCheckInterval; //!< Shortest time between two polls of the resource manager for the energy spent; polls are made at wakeups.
+		double energyTierSleepFactor; //!< Factor applied to the node's own sleep, per tier.
+		double energyTierListenFactor; //!< Factor applied to listenInterval, per tier.
+		double initialEnergy; //!< The initial energy of the node, from the resource manager.
+		double baseListenInterval; //!< listenInterval in tier 0.
+		int energyTier; //!< The current tier; 0 while the remaining energy is above the first threshold.
+		double energySleepScale; //!< The factor applied to the node's own sleep: advertisedSleepScale, once a frame advertising it has been sent.
+		double advertisedSleepScale; //!< energyTierSleepFactor to the power energyTier; the sleep advertised in the frames sent is scaled by it.
+		double nextEnergyCheck; //!< Time from which the resource manager is polled again.
+		vector<double> energyTierEntryTimes; //!< The time each tier was entered, indexed by tier - 1.
+		double randomTxOffset; //!< random offset to get nodes out of sync. \bug Not entirely effective on its own; see startupPhaseJitter and rephaseAfterBusyCCAs.
+		int rngStream; //!< The random number stream (genk_dblrand()) used for all the random offsets of the module.
+		bool startupPhaseJitter; //!< Offset the first wakeup by a random fraction of the duty cycle at APP_NODE_STARTUP.
+		int rephaseAfterBusyCCAs; //!< Number of consecutive busy carrier senses after which the phase of the duty cycle is shifted by a random fraction of sleepInterval. 0 disables rephasing.
+		
+		bool pdesMode; //!< Make no direct method calls to other modules, so that the node can run under parallel simulation (see carrierSenseValidity()).
+		double radioLinkDelay; //!< In pdesMode, the delay of the connections between the MAC and the radio, in both directions; at most pdesLookahead.
+		double pdesLookahead; //!< The largest radioLinkDelay the carrier sense tolerates: the minimum lookahead of a partition boundary between the MAC and the radio.
+		bool blockingSend; //!< Keep a frame that could not be sent because the carrier was busy, and retry; if false, the frame is dropped.
+		bool unicastEarlyAck; //!< Send unicast frames as a train, and listen for an ack from the destination after each copy; the ack ends the train.
+		bool txTrainMode; //!< Send the redundant copies one at a time, each after the radio has finished sending the previous one.
+		bool aggregateFrames; //!< Aggregate the frames queued for the same destination into a single MAC frame, up to maxMacFrameSize.
+		int earlySleepClearCCAs; //!< Number of consecutive clear carrier senses, covering at least the time to transmit a maximum sized frame, after which the radio sleeps before the end of listenInterval. 0 disables early sleep.
+		bool inlineZeroDelayHops; //!< Handle the zero-delay self-messages that end a handler as direct calls, instead of scheduling them (see postSelfMessage()).
+		int inlineDepth; //!< Number of self-messages being handled inline, one inside the other.
+		long lastSendEvent; //!< The simulation event in which a message for the current time was last sent to another module; the hops of that event are not inlined.
+		static const int maxInlineDepth = 4; //!< Largest inlineDepth; deeper hops are scheduled as usual.
 		
 		int maxMacFrameSize; //!< Maximum MAC frame size.
 		int macBufferSize; //!< the size of the transmission Buffer.
 		int macFrameOverhead; //!< the size of the MAC headers.
+		int seqCacheSize; //!< Number of neighbours whose last sequence number is cached for duplicate suppression.
+		int queuePriorityLevels; //!< Number of priority levels of the transmission buffer; 1 makes it a FIFO.
+		double txFrameLifetime; //!< Time a frame may wait in the transmission buffer before it is dropped; 0 if frames do not expire.
+		bool dropOldestWhenFull; //!< When the transmission buffer is full, evict its oldest, least urgent frame instead of dropping the new one (bufferFullPolicy).
+		string checkpointFile; //!< If not empty, the state of the module is saved in finish(), to checkpointFile.<node ID>.
+		string restoreFile; //!< If not empty, the state of the module is restored at the end of initialize(), from restoreFile.<node ID>.
+		bool restored; //!< Indicate whether the state was restored from a checkpoint; APP_NODE_STARTUP then does not restart a running duty cycle.
 		
 		//! Custom Class parameters
 		RadioModule *radioModule;	//!< a pointer to the object of the Radio Module (used for direct method calls).
 		ResourceGenericManager *resMgrModule;	//!< a pointer to the object of the Radio Module (used for direct method calls).
-		MAC_GenericFrame **schedTXBuffer;		//!< a circular buffer that holds frames for transmission.
+		MultiLevelQueue<SpeckMacFrame *> schedTXBuffer;		//!< a circular buffer per priority level, that holds frames for transmission.
+		BackoffPolicy *backoff; //!< The back-off policy, selected by the backoffPolicy parameter.
+		SequenceCache rxSeqCache; //!< The last sequence number received from each neighbour.
+		int nextSeqNum; //!< The sequence number of the next frame to be sent.
 		
-		cMessage *dutyCycleSleepMsg;	//!< Duty cycle sleep message.
-		cMessage *dutyCycleWakeupMsg;	//!< Duty cycle wakeup message.
+		// Persistent self-messages; created once in initialize(), rescheduled as required, and deleted in finish().
+		MAC_ControlMessage *dutyCycleSleepMsg;	//!< Duty cycle sleep message.
+		MAC_ControlMessage *dutyCycleWakeupMsg;	//!< Duty cycle wakeup message.
+		MAC_ControlMessage *performCSMsg; //!< message to start a carrier sense.
 		MAC_ControlMessage *selfExitCSMsg; //!< message to exit Carrier sense; indicating channel is free.
+		MAC_ControlMessage *checkTxBufferMsg; //!< message to send the frame at the head of the transmission buffer.
+		MAC_ControlMessage *initiateTxMsg; //!< message to initiate a transmission.
+		MAC_ControlMessage *ackTimeoutMsg; //!< message to send the next copy of a unicast train, if no early ack was received.
 		
 		bool doTx; //!< Indicate if a transmission has to be performed.
 		
+		SpeckMacFrame *trainFrame; //!< In train mode, the frame being sent; NULL once its last copy has been handed to the radio.
+		int trainCopiesSent; //!< In train mode, the number of copies of trainFrame sent so far.
+		bool trainAwaitsAck; //!< Indicate whether the sender listens for an early ack after each copy of trainFrame.
+		
 		int self; //!< The node's ID.
 		int macState; //!< The state of the MAC layer.
-		int headTxBuffer; //!< The position of the head of the buffer (pop position).
-		int tailTxBuffer; //!< The position of the tail of the buffer (pop position).
 		int disabled; //!< bool, to indicate if MAC module is operational or not.
+		bool shutDown; //!< Indicate whether the node has run out of energy; it is then never enabled again (see outOfEnergy()).
+		double shutDownTime; //!< The time the node ran out of energy.
 		int phyLayerOverhead; //!< The physical layer overhead.
 		int redundancy; //!< The number of redundant retransmissions for SpeckMAC-D
 
-#ifdef STATISTICS		
-		int numRecd; //!< statistics member to count number of received packets.
-		int numSent; //!< statistics member to count number of sent packets.
-#endif
+		// Performance counters; always on, and recorded as scalars in finish().
+		long framesSent; //!< Number of frames sent (each one counted once, however many copies of it were sent).
+		long copiesSent; //!< Number of redundant copies sent, in addition to the frames themselves.
+		long acksSent; //!< Number of early acks sent.
+		long acksReceived; //!< Number of early acks received, each of which ended a train.
+		long copiesSaved; //!< Number of redundant copies not sent because of early acks.
+		long framesReceived; //!< Number of frames received from the radio, excluding duplicates.
+		long duplicatesDropped; //!< Number of duplicate frames received from the radio, and dropped.
+		long overheardDropped; //!< Number of unicast frames addressed to other nodes received from the radio, and dropped.
+		long carrierBusyCount; //!< Number of carrier senses that found the carrier busy.
+		long busyWhileTx; //!< Number of busy carrier senses performed before a transmission.
+		long busyWhileListening; //!< Number of busy carrier senses performed to check the medium for frames.
+		long aggregatedFrames; //!< Number of frames sent inside another frame, rather than on their own.
+		long deferredWakeups; //!< Number of wakeups and transmissions deferred to the end of a train heard by the node.
+		long sleepIntervalChanges; //!< Number of changes of sleepInterval by the adaptive duty cycle.
+		long rephases; //!< Number of random duty cycle phase shifts.
+		long earlySleeps; //!< Number of listen intervals cut short by early sleep.
+		long rxFailed; //!< Number of times that no frame was received in MAC_STATE_EXPECTING_RX before the timeout.
+		long bufferFullDrops; //!< Number of frames dropped because the transmission buffer was full.
+		long oversizedDrops; //!< Number of network frames dropped because they do not fit in maxMacFrameSize.
+		long busyDrops; //!< Number of frames dropped because the carrier was busy (without blockingSend).
+		long inlinedHops; //!< Number of zero-delay self-messages handled as direct calls (inlineZeroDelayHops).
+		long expiredDrops; //!< Number of frames dropped from the transmission buffer because their deadline had passed.
+		long bufferFullEvictions; //!< Number of frames evicted from the full transmission buffer to make room for a more urgent or newer frame.
+		long energyTierDrops; //!< Number of network frames refused because their priority is too low for the energy tier.
+		long shutDownDrops; //!< Number of frames discarded from the transmission buffer when the node ran out of energy.
+		double radioOnTime; //!< Time for which the radio has been commanded to listen or transmit.
+		double radioSleepTime; //!< Time for which the radio has been commanded to sleep.
+		double lastRadioStateChange; //!< Time up to which the radio time has been accounted.
+		bool radioOn; //!< Indicate whether the last radio state command that took effect switched the radio on.
+		RadioCommandQueue radioCommandsToAccount; //!< The radio state commands that have not taken effect yet, for accountRadioTime().
+		
+		bool recordVectors; //!< Indicate whether the optional output vectors are recorded.
+		cOutVector txBufferVector; //!< Occupancy of the transmission buffer.
+		cOutVector carrierSenseVector; //!< Outcome of each carrier sense (1 = busy, 0 = free).
+		cOutVector sleepIntervalVector; //!< sleepInterval, whenever the adaptive duty cycle changes it.
 
 		double epsilon;
-		double cpuClockDrift; //!< Clock drift of CPU.
+		LocalClock localClock; //!< The node's clock: the CPU clock drift, and its variation with temperature (clockSkewWander).
 		double radioDataRate; //!< Data rate of radio (e.g. 250 kbps for CC2420)
 		double radioDelayForValidCS; //!< Time required before radio can perform Carrier Sense.
+		
+		// The radio state as modelled by the MAC from its own commands and the radio's notifications; used in pdesMode instead of RadioModule::isCarrierSenseValid().
+		int modelledRadioState; //!< The state command in effect at the radio.
+		RadioCommandQueue pendingRadioCommands; //!< The state commands that have not reached the radio yet, in the order they take effect there.
+		double carrierSenseValidTime; //!< The time from which the radio's carrier sense indication is valid.
 		double dataTXtime; //!< Time to transmit the MAC Frame.
 		double lastWakeupTime; //!< Time last wakeup message was received.
+		double trainEndTime; //!< Time at which the last redundant train heard by the node ends; no frame can be received, and no transmission can start, before then.
+		double trainCoverInterval; //!< The sleep interval the next redundant train must cover; longer than sleepInterval until a train has been sent after the interval was shortened, or while a neighbour sleeps longer (neighbourSleepInterval).
+		double advertisedSleepInterval; //!< The sleep interval advertised in the frames sent; longer than sleepInterval while a lengthening waits to be advertised (see adaptDutyCycle()).
+		double neighbourSleepInterval; //!< The longest sleep interval advertised by the neighbours heard (adaptive duty cycle); 0 if none was heard.
+		int idleCycles; //!< Number of consecutive duty cycles without traffic.
+		long framesReceivedAtAdaptation; //!< Value of framesReceived when the duty cycle was last adapted.
+		double ackWaitTime; //!< Time the sender of a unicast train listens for an early ack after each copy: the radio turnaround and the airtime of an ack, in local time.
+		double expectingRxTimeout; //!< Time to wait for a frame when the carrier is busy: the time to transmit two maximum sized MAC frames, in local time.
+		double earlySleepSpan; //!< Time the consecutive clear carrier senses must cover before early sleep: the time to transmit a maximum sized MAC frame, in local time.
+		int consecutiveBusyCCAs; //!< Number of consecutive busy carrier senses.
+		double pendingPhaseShift; //!< Extra sleep time added to the next sleep, to shift the phase of the duty cycle.
+		int clearCCAs; //!< Number of consecutive clear carrier senses since the last wakeup, busy carrier sense, or command that stopped the radio listening.
+		double clearCCAsStart; //!< Time at which the first of the consecutive clear carrier senses started.
+		
+		vector<double> txTimeByLength; //!< Time to transmit a MAC frame, indexed by the length of the frame in bytes (up to maxMacFrameSize).
+		vector<int> redundancyByLength; //!< Number of redundant copies to send for a MAC frame, indexed by the length of the frame in bytes, so that the train covers trainCoverInterval.
+		
+		long transitionCounts[MAC_STATE_COUNT][MAC_STATE_COUNT]; //!< Number of transitions between each pair of states, indexed [from][to].
+		long rejectedEvents; //!< Number of events that had no handler in the state they were received in.
+		
+		typedef void (SpeckMacModule::*MacEventHandler)(cMessage *msg); //!< Handler of an event in a given state.
+		static const MacEventHandler transitionTable[MAC_STATE_COUNT][MAC_EVENT_COUNT]; //!< The handler of each event in each state; NULL rejects the event.
+		
+		//! Adapt a handler that does not use the message to a MacEventHandler.
+		template <void (SpeckMacModule::*method)()>
+		void dispatch(cMessage *msg) { (this->*method)(); }
+		
+#ifdef SPECKMAC_PROFILE
+		/*!
+			\struct EventProfile
+			\brief The cost of handling an event (SPECKMAC_PROFILE).
+		*/
+		struct EventProfile
+		{
+			long count; //!< Number of messages handled.
+			double handlerTime; //!< Wall clock time spent handling them, in seconds.
+			long spawned; //!< Number of messages scheduled or sent while handling them.
+			long zeroDelaySelf; //!< Number of self-messages scheduled for the current time while handling them.
+			long inlined; //!< Number of the messages handled that were handled inline (inlineZeroDelayHops), rather than scheduled.
+		};
+		
+		EventProfile eventProfile[MAC_EVENT_COUNT + 1]; //!< The profile of each event; MAC_EVENT_UNKNOWN holds unknown messages, and messages received while the module is disabled.
+		EventProfile *currentProfile; //!< The profile of the event being handled; NULL outside handleMessage().
+		
+		static double profileClock();
+		void recordProfile();
+		void countSpawned() {if (currentProfile != NULL) currentProfile->spawned++;}
+		
+		// Counting version of the cSimpleModule method the module uses; it hides the original.
+		int scheduleAt(double t, cMessage *msg)
+		{
+			countSpawned();
+			if ( (currentProfile != NULL) && (t <= simTime()) )
+				currentProfile->zeroDelaySelf++;
+			return cSimpleModule::scheduleAt(t, msg);
+		}
+#endif
+		
+		// Versions of the cSimpleModule methods the module sends through; they hide the originals, record the event of a send for the current time (see postSelfMessage()), and count the send with SPECKMAC_PROFILE.
+		int send(cMessage *msg, const char *gateName) {messageSent(0.0); return cSimpleModule::send(msg, gateName);}
+		int sendDelayed(cMessage *msg, double delay, const char *gateName) {messageSent(delay); return cSimpleModule::sendDelayed(msg, delay, gateName);}
+		void messageSent(double delay)
+		{
+			if (delay <= 0.0)
+				lastSendEvent = simulation.eventNumber();
+#ifdef SPECKMAC_PROFILE
+			countSpawned();
+#endif
+		}
 		
 	protected:
 		virtual void initialize();
 		virtual void finish();
 		virtual void handleMessage(cMessage *msg);
+		void handleEvent(cMessage *msg);
 		
 		void readIniFileParameters();
+		void precomputeFrameTimings();
+		void precomputeRedundancies();
+		void adaptDutyCycle();
+		void setSleepInterval(double newInterval, const char *reason);
+		void checkEnergyTier();
+		void enterEnergyTier(int tier, double remaining);
+		bool refusedByEnergyTier(int priority);
 		void setRadioState(MAC_ContorlMessageType typeID, double delay = 0.0);
-		inline void dutyCycle (int typeID);
+		void modelRadioCommand(int typeID, double when);
+		void modelRadioStoppedTx();
+		void updateModelledRadio();
+		int carrierSenseValidity();
+		void accountRadioTime(double until);
+		const char *messageName(const char *name) {return nameFrames ? name : NULL;} //!< The name of a message sent by the module: \b name with nameFrames, none otherwise.
+		double localToSim(double localDuration) {return localClock.toSimTime(localDuration, simTime());} //!< Convert a duration measured by the node's timer, from now, into simulation time.
+		void rescheduleSelfMessage(cMessage *msg, double delay = 0.0);
+		void cancelSelfMessage(cMessage *msg);
+		void postSelfMessage(cMessage *msg);
+		bool isPersistentSelfMessage(cMessage *msg);
+		bool isDroppedWhileDisabled(int msgKind) {return (disabled == TRUE) && ((msgKind != APP_NODE_STARTUP) || shutDown);} //!< Messages of kind \b msgKind are dropped unhandled.
+		int eventOf(int msgKind);
+		void setMacState(int newState, const char *reason);
+		void nodeStartup();
+		double jitter();
+		void initiateTransmission();
+		void txStartedWhileSensing();
+		void txStarted();
+		void receiveFrame(cMessage *msg);
+		void outOfEnergy();
+		void ignoreEvent();
+		void dutyCycleSleep();
+		void expectedRxFailed();
+		void dutyCycleWakeup();
+		bool deferToTrainEnd(cMessage *msg);
 		inline void handleNetworkLayerFrame(cMessage *msg);
 		void pushFrameIntoBuffer(cMessage *msg);
-		int pushBuffer(MAC_GenericFrame *theFrame);
+		int pushBuffer(SpeckMacFrame *theFrame);
 		void initiateCarrierSense();
 		void performCarrierSense();
-		int encapsulateNetworkFrame(Network_GenericFrame *networkFrame, MAC_GenericFrame *retFrame);
+		int encapsulateNetworkFrame(Network_GenericFrame *networkFrame, SpeckMacFrame *retFrame);
 		int getTXBufferSize(void);
 		int resolvDestination(const char *);
 		void carrierFree();
 		void carrierBusy();
-		inline void sendData();
-		inline void finishDataTransmission();
-		MAC_GenericFrame *popTxBuffer();
+		void sendData();
+		void unexpectedTxBufferCheck();
+		void sendNextTrainCopy();
+		void ackTimeout();
+		void sendAck(SpeckMacFrame *rcvFrame);
+		void receiveAck(SpeckMacFrame *ackFrame);
+		void finishDataTransmission();
+		void sleepUntilNextWakeup();
+		bool channelIdleLongEnough();
+		void sleepEarly();
+		SpeckMacFrame *popTxBuffer(bool aggregate);
+		bool canAggregate(SpeckMacFrame *dataFrame, SpeckMacFrame *nextFrame);
+		void dropExpiredFrame(SpeckMacFrame *dataFrame);
+		bool evictForFrame(SpeckMacFrame *dataFrame);
+		void saveCheckpoint(const char *fileName);
+		void restoreCheckpoint(const char *fileName);
+		void transferState(cCommBuffer *b, bool packing);
+		void transferTime(cCommBuffer *b, bool packing, double &time);
+		void transferFrame(cCommBuffer *b, bool packing, SpeckMacFrame *&frame);
+		void resumeRestoredState();
 };
 
 #endif
@@ -0,0 +1,38 @@
+/*!
+	\file AllocationCounter.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Replaces the global operator new and operator delete of the SpeckMAC-D benchmark with counting versions.
+*/
+
+#include <cstdlib>
+#include <new>
+#include "AllocationCounter.h"
+
+static long numAllocations = 0; //!< The number of calls to operator new.
+
+long heapAllocations()
+{
+	return numAllocations;
+}
+
+#if __cplusplus >= 201103L
+void *operator new(size_t size)
+#else
+void *operator new(size_t size) throw (std::bad_alloc)
+#endif
+{
+	numAllocations++;
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+#if __cplusplus >= 201103L
+void operator delete(void *p) noexcept
+#else
+void operator delete(void *p) throw ()
+#endif
+{
+	free(p);
+}
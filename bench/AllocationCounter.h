@@ -0,0 +1,17 @@
+/*!
+	\file AllocationCounter.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Counts the heap allocations made by the SpeckMAC-D benchmark.
+*/
+
+#ifndef ALLOCATIONCOUNTER
+#define ALLOCATIONCOUNTER
+
+/*!
+	\brief The number of calls to the global operator new (and new[]) since the program started.
+
+	The benchmark replaces the global operator new and operator delete with versions that count the calls; FreeListPool hits never reach them.
+*/
+long heapAllocations();
+
+#endif
@@ -0,0 +1,62 @@
+/*!
+	\file BenchChannel.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the ideal wireless channel used by the SpeckMAC-D benchmark.
+*/
+
+#include "BenchChannel.h"
+#include "RadioModule.h"
+
+Define_Module(BenchChannel);
+
+void BenchChannel::initialize()
+{
+	radios.resize((int) parentModule()->par("numNodes"), NULL);
+	neighbours = parentModule()->par("neighbours");
+	transmissions = signalsDelivered = 0;
+}
+
+void BenchChannel::handleMessage(cMessage *msg)
+{
+	delete msg;
+}
+
+void BenchChannel::finish()
+{
+	recordScalar("channel transmissions", transmissions);
+	recordScalar("channel signals delivered", signalsDelivered);
+}
+
+/*!
+	\brief Register the radio of node \b nodeIndex (called by the radio when it initialises).
+*/
+void BenchChannel::attach(int nodeIndex, RadioModule *radio)
+{
+	if ( (nodeIndex < 0) || (nodeIndex >= (int) radios.size()) )
+		opp_error("\n[BenchChannel]:\n Node index %d out of range.", nodeIndex);
+	radios[nodeIndex] = radio;
+}
+
+/*!
+	\brief Hand a frame transmitted by node \b nodeIndex to the radios in range. The sender keeps ownership of the frame.
+*/
+void BenchChannel::transmit(int nodeIndex, cMessage *frame, double duration)
+{
+	Enter_Method_Silent();
+	
+	int numNodes = radios.size();
+	int range = ( (neighbours <= 0) || (2 * neighbours >= numNodes) ) ? (numNodes - 1) : (2 * neighbours);
+	
+	transmissions++;
+	for (int i = 1; i <= range; i++)
+	{
+		// With a limited range, the neighbours are taken alternately on either side of the sender.
+		int offset = (range == numNodes - 1) ? i : ( (i % 2) ? (i + 1) / 2 : numNodes - i / 2 );
+		RadioModule *radio = radios[(nodeIndex + offset) % numNodes];
+		if (radio != NULL)
+		{
+			radio->signalStart(frame, duration);
+			signalsDelivered++;
+		}
+	}
+}
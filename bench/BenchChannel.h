@@ -0,0 +1,40 @@
+/*!
+	\file BenchChannel.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the ideal wireless channel used by the SpeckMAC-D benchmark.
+*/
+
+#ifndef BENCHCHANNEL
+#define BENCHCHANNEL
+
+#include <vector>
+#include <omnetpp.h>
+
+class RadioModule;
+
+/*!
+ \class BenchChannel
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Hands every transmitted frame to the radios in range of the sender.
+
+ The nodes are placed on a ring; a node is in range of the \b neighbours nodes on either side of it (all the nodes if \b neighbours is 0), so that the work per frame does not grow with the number of nodes. The channel is passive: frames are handed over by direct method calls, and only the radios schedule events.
+*/
+class BenchChannel : public cSimpleModule
+{
+	private:
+		std::vector<RadioModule *> radios; //!< The radio of each node, by node index.
+		int neighbours; //!< The number of nodes in range on either side of a node; 0 for all the nodes.
+		long transmissions; //!< Number of frames transmitted.
+		long signalsDelivered; //!< Number of frames handed to a radio in range.
+
+	protected:
+		virtual void initialize();
+		virtual void handleMessage(cMessage *msg);
+		virtual void finish();
+
+	public:
+		void attach(int nodeIndex, RadioModule *radio);
+		void transmit(int nodeIndex, cMessage *frame, double duration);
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*!
+	\file BenchMonitor.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the module that measures the SpeckMAC-D benchmark.
+*/
+
+#include <cstdio>
+#include "BenchMonitor.h"
+#include "BenchTrafficGenerator.h"
+#include "AllocationCounter.h"
+
+Define_Module(BenchMonitor);
+
+BenchMonitor::BenchMonitor()
+{
+	sampleMsg = NULL;
+}
+
+BenchMonitor::~BenchMonitor()
+{
+	cancelAndDelete(sampleMsg);
+}
+
+void BenchMonitor::initialize()
+{
+	sampleInterval = par("sampleInterval");
+	started = false;
+	fesSamples = 0;
+	fesLengthSum = 0.0;
+	fesLengthMax = 0;
+	fesVector.setName("FES length");
+	
+	sampleMsg = new cMessage("sample FES", 0);
+	scheduleAt(simTime(), sampleMsg);
+}
+
+void BenchMonitor::handleMessage(cMessage *msg)
+{
+	if (!started)
+	{
+		gettimeofday(&wallStart, NULL);
+		simStart = simTime();
+		eventsAtStart = simulation.eventNumber();
+		allocationsAtStart = heapAllocations();
+		started = true;
+	}
+	
+	int fesLength = simulation.msgQueue.length();
+	fesSamples++;
+	fesLengthSum += fesLength;
+	if (fesLength > fesLengthMax)
+		fesLengthMax = fesLength;
+	fesVector.record(fesLength);
+	
+	scheduleAt(simTime() + sampleInterval, sampleMsg);
+}
+
+void BenchMonitor::finish()
+{
+	struct timeval wallEnd;
+	gettimeofday(&wallEnd, NULL);
+	
+	double wallTime = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_usec - wallStart.tv_usec) / 1e6;
+	double simulatedTime = simTime() - simStart;
+	long events = simulation.eventNumber() - eventsAtStart;
+	long allocations = heapAllocations() - allocationsAtStart;
+	long delivered = BenchTrafficGenerator::totalDelivered;
+	
+	double eventsPerSecond = (wallTime > 0.0) ? events / wallTime : 0.0;
+	double wallPerSimSecond = (simulatedTime > 0.0) ? wallTime / simulatedTime : 0.0;
+	double allocationsPerFrame = (delivered > 0) ? (double) allocations / delivered : 0.0;
+	double fesLengthMean = (fesSamples > 0) ? fesLengthSum / fesSamples : 0.0;
+	double latencyMean = (delivered > 0) ? BenchTrafficGenerator::totalLatency / delivered : 0.0;
+	
+	recordScalar("bench events", events);
+	recordScalar("bench events per second", eventsPerSecond);
+	recordScalar("bench wall clock per simulated second", wallPerSimSecond);
+	recordScalar("bench heap allocations per delivered frame", allocationsPerFrame);
+	recordScalar("bench mean FES length", fesLengthMean);
+	recordScalar("bench max FES length", fesLengthMax);
+	recordScalar("bench frames generated", BenchTrafficGenerator::totalGenerated);
+	recordScalar("bench frames delivered", delivered);
+	recordScalar("bench mean latency", latencyMean);
+	
+	printf("BENCH nodes=%d events=%ld events/s=%.0f wall/simsec=%.6f allocs/frame=%.2f fes_mean=%.1f fes_max=%d generated=%ld delivered=%ld latency=%.4f\n",
+		(int) parentModule()->par("numNodes"), events, eventsPerSecond, wallPerSimSecond, allocationsPerFrame, fesLengthMean, fesLengthMax, BenchTrafficGenerator::totalGenerated, delivered, latencyMean);
+	fflush(stdout);
+}
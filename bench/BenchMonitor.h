@@ -0,0 +1,49 @@
+/*!
+	\file BenchMonitor.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the module that measures the SpeckMAC-D benchmark.
+*/
+
+#ifndef BENCHMONITOR
+#define BENCHMONITOR
+
+#include <sys/time.h>
+#include <omnetpp.h>
+
+/*!
+ \class BenchMonitor
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Measures the simulation performance of a benchmark run.
+
+ The measurement starts with the first event, once every module has been initialised. The length of the future event set (FES) is sampled every \b sampleInterval of simulated time. finish() records, as scalars, and prints on one line of the standard output (for bench/sweep.sh):
+ - events per second, and wall clock time per simulated second;
+ - heap allocations per delivered frame (see AllocationCounter.h);
+ - mean and maximum FES length;
+ - the frames generated and delivered, and their mean latency.
+*/
+class BenchMonitor : public cSimpleModule
+{
+	private:
+		cMessage *sampleMsg; //!< Self-message sampling the FES length.
+		double sampleInterval; //!< Simulated time between FES samples.
+		struct timeval wallStart; //!< Wall clock time at the first event.
+		double simStart; //!< Simulated time at the first event.
+		long eventsAtStart; //!< Event number at the first event.
+		long allocationsAtStart; //!< Heap allocations made before the first event.
+		bool started; //!< Indicate whether the first event has been seen.
+		long fesSamples; //!< Number of FES samples taken.
+		double fesLengthSum; //!< Sum of the sampled FES lengths.
+		int fesLengthMax; //!< Largest sampled FES length.
+		cOutVector fesVector; //!< The sampled FES lengths.
+
+	protected:
+		virtual void initialize();
+		virtual void handleMessage(cMessage *msg);
+		virtual void finish();
+
+	public:
+		BenchMonitor();
+		virtual ~BenchMonitor();
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*!
+	\file BenchTrafficGenerator.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the synthetic traffic source and sink used by the SpeckMAC-D benchmark.
+*/
+
+#include <cstdio>
+#include "BenchTrafficGenerator.h"
+#include "App_ControlMessage_m.h"
+#include "NetworkGenericFrame_m.h"
+#include "MacGenericFrame_m.h"
+#include "MacControlMessage_m.h"
+
+Define_Module(BenchTrafficGenerator);
+
+long BenchTrafficGenerator::totalGenerated = 0;
+long BenchTrafficGenerator::totalDelivered = 0;
+double BenchTrafficGenerator::totalLatency = 0.0;
+
+BenchTrafficGenerator::BenchTrafficGenerator()
+{
+	generateMsg = NULL;
+}
+
+BenchTrafficGenerator::~BenchTrafficGenerator()
+{
+	cancelAndDelete(generateMsg);
+}
+
+void BenchTrafficGenerator::initialize()
+{
+	packetRate = par("packetRate");
+	payloadSize = par("payloadSize");
+	unicastFraction = par("unicastFraction");
+	
+	cModule *network = parentModule()->parentModule()->parentModule();
+	numNodes = network->par("numNodes");
+	neighbours = network->par("neighbours");
+	self = parentModule()->parentModule()->index();
+	
+	generated = delivered = fullBufferNotices = 0;
+	latencyVector.setName("latency");
+	
+	send(new App_ControlMessage("node startup App->MAC", APP_NODE_STARTUP), "toMacModule");
+	
+	generateMsg = new cMessage("generate frame", 0);
+	if (packetRate > 0.0)
+		scheduleAt(simTime() + (double) par("startupDelay") + exponential(1.0 / packetRate), generateMsg);
+}
+
+void BenchTrafficGenerator::handleMessage(cMessage *msg)
+{
+	if (msg == generateMsg)
+	{
+		Network_GenericFrame *frame = new Network_GenericFrame("bench frame", NET_FRAME);
+		char destination[16];
+		
+		sprintf(destination, "%d", pickDestination());
+		frame->getHeader().destCtrl = destination;
+		frame->setByteLength(payloadSize);
+		frame->setTimestamp(simTime());
+		send(frame, "toMacModule");
+		generated++;
+		totalGenerated++;
+		
+		scheduleAt(simTime() + exponential(1.0 / packetRate), generateMsg);
+		return;
+	}
+	
+	if (msg->kind() == NET_FRAME)
+	{
+		delivered++;
+		totalDelivered++;
+		totalLatency += simTime() - msg->timestamp();
+		latencyVector.record(simTime() - msg->timestamp());
+	}
+	else if (msg->kind() == MAC_2_NETWORK_FULL_BUFFER)
+	{
+		fullBufferNotices++;
+	}
+	
+	delete msg;
+}
+
+void BenchTrafficGenerator::finish()
+{
+	recordScalar("bench frames generated", generated);
+	recordScalar("bench frames delivered", delivered);
+	recordScalar("bench full buffer notices", fullBufferNotices);
+}
+
+/*!
+	\brief Draw the destination of a generated frame: BROADCAST_ADDR, or one of the nodes in range.
+*/
+int BenchTrafficGenerator::pickDestination()
+{
+	if ( (numNodes < 2) || (uniform(0, 1) >= unicastFraction) )
+		return BROADCAST_ADDR;
+	
+	int range = ( (neighbours <= 0) || (2 * neighbours >= numNodes) ) ? (numNodes - 1) / 2 : neighbours;
+	if (range < 1)
+		range = 1;
+	
+	int offset = intuniform(1, range);
+	if (intuniform(0, 1) == 1)
+		offset = numNodes - offset;
+	return (self + offset) % numNodes;
+}
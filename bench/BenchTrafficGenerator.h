@@ -0,0 +1,51 @@
+/*!
+	\file BenchTrafficGenerator.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the synthetic traffic source and sink used by the SpeckMAC-D benchmark.
+*/
+
+#ifndef BENCHTRAFFICGENERATOR
+#define BENCHTRAFFICGENERATOR
+
+#include <omnetpp.h>
+
+/*!
+ \class BenchTrafficGenerator
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Takes the place of the network layer above SpeckMacModule: starts the MAC, sends it network frames, and counts the frames it delivers.
+
+ Frames are generated as a Poisson process of rate \b packetRate, with \b payloadSize bytes each. A fraction \b unicastFraction of them is sent to a random node among the \b neighbours nearest nodes on the ring (see BenchChannel); the others are broadcast. The totals over all the nodes are kept in static counters, which BenchMonitor reads.
+*/
+class BenchTrafficGenerator : public cSimpleModule
+{
+	private:
+		double packetRate; //!< Frames generated per second.
+		int payloadSize; //!< Length of the generated network frames, in bytes.
+		double unicastFraction; //!< Fraction of the frames sent to a single neighbour.
+		int numNodes; //!< The number of nodes.
+		int neighbours; //!< The number of nodes in range on either side of a node.
+		int self; //!< The node's ID.
+		cMessage *generateMsg; //!< Self-message generating the next frame.
+
+		long generated; //!< Number of frames generated by this node.
+		long delivered; //!< Number of frames delivered to this node.
+		long fullBufferNotices; //!< Number of MAC_2_NETWORK_FULL_BUFFER notifications.
+		cOutVector latencyVector; //!< Latency of the delivered frames.
+
+		int pickDestination();
+
+	protected:
+		virtual void initialize();
+		virtual void handleMessage(cMessage *msg);
+		virtual void finish();
+
+	public:
+		BenchTrafficGenerator();
+		virtual ~BenchTrafficGenerator();
+
+		static long totalGenerated; //!< Frames generated by all the nodes.
+		static long totalDelivered; //!< Frames delivered to all the nodes (each copy of a broadcast frame counts).
+		static double totalLatency; //!< Sum of the latencies of the delivered frames.
+};
+
+#endif
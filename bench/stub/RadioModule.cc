@@ -0,0 +1,242 @@
+/*!
+	\file RadioModule.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the stub radio used by the SpeckMAC-D benchmark.
+*/
+
+#include "RadioModule.h"
+#include "BenchChannel.h"
+
+Define_Module(RadioModule);
+
+RadioModule::RadioModule() : txBuffer("radio buffer")
+{
+	txEndMsg = rxEndMsg = rxFrame = NULL;
+}
+
+RadioModule::~RadioModule()
+{
+	cancelAndDelete(txEndMsg);
+	cancelAndDelete(rxEndMsg);
+	delete rxFrame;
+}
+
+void RadioModule::initialize()
+{
+	dataRate = par("dataRate");
+	delayCSValid = ((double) par("delayCSValid")) / 1000.0; // given in ms, as for Castalia's radio.
+	phyFrameOverhead = par("phyFrameOverhead");
+	bufferSize = par("bufferSize");
+	nodeIndex = parentModule()->parentModule()->index();
+
+	cModule *network = parentModule()->parentModule()->parentModule();
+	channel = check_and_cast<BenchChannel*>(network->submodule("wirelessChannel"));
+	channel->attach(nodeIndex, this);
+
+	txEndMsg = new cMessage("end of TX", 0);
+	rxEndMsg = new cMessage("end of RX", 1);
+	rxCorrupt = false;
+	sleepAfterTx = false;
+	state = RADIO_STATE_SLEEP;
+	csValidTime = busyUntil = senseEnd = 0.0;
+
+	framesTransmitted = framesDelivered = collisions = bufferDrops = 0;
+}
+
+void RadioModule::handleMessage(cMessage *msg)
+{
+	if (msg == txEndMsg)
+	{
+		startNextTx();
+		return;
+	}
+
+	if (msg == rxEndMsg)
+	{
+		endReception();
+		return;
+	}
+
+	switch (msg->kind())
+	{
+		case MAC_FRAME:
+		{
+			if (txBuffer.length() >= bufferSize)
+			{
+				delete msg;
+				bufferDrops++;
+			}
+			else
+			{
+				txBuffer.insert(msg);
+			}
+			return;
+		}
+
+		case MAC_2_RADIO_ENTER_TX:
+		{
+			if (state != RADIO_STATE_TX)
+			{
+				setState(RADIO_STATE_TX);
+				notifyMac(RADIO_2_MAC_STARTED_TX);
+				startNextTx();
+			}
+			break;
+		}
+
+		case MAC_2_RADIO_ENTER_LISTEN:
+		{
+			if (state == RADIO_STATE_TX)
+				sleepAfterTx = false; // the radio listens once the buffer is empty.
+			else if (state != RADIO_STATE_LISTEN)
+				setState(RADIO_STATE_LISTEN);
+			break;
+		}
+
+		case MAC_2_RADIO_ENTER_SLEEP:
+		{
+			if (state == RADIO_STATE_TX)
+				sleepAfterTx = true;
+			else
+				setState(RADIO_STATE_SLEEP);
+			break;
+		}
+
+		case MAC_2_RADIO_SENSE_CARRIER:
+		{
+			MAC_ControlMessage *csMsg = check_and_cast<MAC_ControlMessage*>(msg);
+			if (simTime() < busyUntil)
+				notifyMac(RADIO_2_MAC_SENSED_CARRIER);
+			else
+				senseEnd = simTime() + csMsg->getSense_carrier_interval();
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	delete msg;
+}
+
+void RadioModule::finish()
+{
+	recordScalar("radio frames transmitted", framesTransmitted);
+	recordScalar("radio frames delivered", framesDelivered);
+	recordScalar("radio collisions", collisions);
+	recordScalar("radio buffer drops", bufferDrops);
+}
+
+/*!
+	\brief Change the state of the radio. A frame being received is lost, and listening restarts the carrier sense settling time.
+*/
+void RadioModule::setState(int newState)
+{
+	if (rxFrame != NULL)
+		rxCorrupt = true;
+	if (newState == RADIO_STATE_LISTEN)
+		csValidTime = simTime() + delayCSValid;
+	state = newState;
+	senseEnd = 0.0;
+}
+
+/*!
+	\brief Transmit the frame at the head of the radio buffer, or leave TX and tell the MAC if the buffer is empty.
+*/
+void RadioModule::startNextTx()
+{
+	if (txBuffer.empty())
+	{
+		setState(sleepAfterTx ? RADIO_STATE_SLEEP : RADIO_STATE_LISTEN);
+		sleepAfterTx = false;
+		notifyMac(RADIO_2_MAC_STOPPED_TX);
+		return;
+	}
+
+	cMessage *frame = (cMessage *) txBuffer.pop();
+	double duration = (double) (frame->byteLength() + phyFrameOverhead) * 8.0 / (1000.0 * dataRate);
+
+	channel->transmit(nodeIndex, frame, duration);
+	framesTransmitted++;
+	delete frame; // the radios in range hold copies.
+
+	scheduleAt(simTime() + duration, txEndMsg);
+}
+
+/*!
+	\brief Deliver the frame being received to the MAC, unless it was corrupted or the radio stopped listening.
+*/
+void RadioModule::endReception()
+{
+	if (!rxCorrupt && (state == RADIO_STATE_LISTEN))
+	{
+		send(rxFrame, "toMacModule");
+		framesDelivered++;
+	}
+	else
+	{
+		delete rxFrame;
+	}
+	rxFrame = NULL;
+}
+
+void RadioModule::notifyMac(int kind)
+{
+	send(new cMessage("radio notification Radio->MAC", kind), "toMacModule");
+}
+
+/*!
+	\return 1 if the carrier sense is valid, or the reason why it is not (RADIO_IN_TX_MODE, RADIO_SLEEPING, RADIO_NON_READY).
+*/
+int RadioModule::isCarrierSenseValid()
+{
+	if (state == RADIO_STATE_TX)
+		return RADIO_IN_TX_MODE;
+	if (state == RADIO_STATE_SLEEP)
+		return RADIO_SLEEPING;
+	if (simTime() < csValidTime)
+		return RADIO_NON_READY;
+	return 1;
+}
+
+/*!
+	\brief A frame in range starts (called by BenchChannel).
+
+	\param frame The frame; it is copied if the radio receives it.
+	\param duration The airtime of the frame.
+*/
+void RadioModule::signalStart(cMessage *frame, double duration)
+{
+	Enter_Method_Silent();
+
+	bool wasBusy = (simTime() < busyUntil);
+	if (simTime() + duration > busyUntil)
+		busyUntil = simTime() + duration;
+
+	if ( (state != RADIO_STATE_LISTEN) || (simTime() < csValidTime) )
+		return;
+
+	if ( (senseEnd > 0.0) && (simTime() <= senseEnd) )
+	{
+		notifyMac(RADIO_2_MAC_SENSED_CARRIER);
+		senseEnd = 0.0;
+	}
+
+	if (wasBusy) // the frame overlaps another one.
+	{
+		if (rxFrame != NULL)
+			rxCorrupt = true;
+		collisions++;
+		return;
+	}
+
+	if (rxEndMsg->isScheduled()) // the previous frame ends as this one starts.
+	{
+		cancelEvent(rxEndMsg);
+		endReception();
+	}
+	
+	rxFrame = (cMessage *) frame->dup();
+	rxCorrupt = false;
+	scheduleAt(simTime() + duration, rxEndMsg);
+}
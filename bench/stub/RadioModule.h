@@ -0,0 +1,75 @@
+/*!
+	\file RadioModule.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the stub radio used by the SpeckMAC-D benchmark in place of Castalia's RadioModule.
+*/
+
+#ifndef RADIOMODULE
+#define RADIOMODULE
+
+#include <omnetpp.h>
+#include "MacGenericFrame_m.h"
+#include "MacControlMessage_m.h"
+
+#define RADIO_IN_TX_MODE 0 //!< \def isCarrierSenseValid(): the radio is transmitting.
+#define RADIO_SLEEPING 2 //!< \def isCarrierSenseValid(): the radio is asleep.
+#define RADIO_NON_READY 3 //!< \def isCarrierSenseValid(): the radio has not been listening for delayCSValid yet.
+
+class BenchChannel;
+
+/*!
+ \class RadioModule
+ \author Siddhu Warrier, University of Edinburgh
+ \brief An ideal radio with the interface SpeckMacModule expects from Castalia's RadioModule.
+
+ The radio sleeps, listens or transmits as commanded by the MAC. Frames are sent to the BenchChannel, which hands them, by direct method calls, to the radios in range. A listening radio receives a frame if it started listening before the frame started, and no other frame overlapped it; there is no path loss, and no other source of error. The carrier is busy while any frame in range is on the air.
+
+ The module is only linked into the benchmark (bench/); it has the name and the parameters (dataRate, delayCSValid, phyFrameOverhead) of Castalia's radio so that SpeckMacModule is compiled unchanged.
+*/
+class RadioModule : public cSimpleModule
+{
+	private:
+		enum RadioStates {RADIO_STATE_SLEEP, RADIO_STATE_LISTEN, RADIO_STATE_TX};
+
+		int state; //!< The state of the radio.
+		double dataRate; //!< The data rate, in kbps.
+		double delayCSValid; //!< The time after entering listen before the carrier sense is valid, in seconds.
+		int phyFrameOverhead; //!< The physical layer overhead, in bytes.
+		int bufferSize; //!< The number of frames the radio buffer holds.
+		int nodeIndex; //!< The index of the node.
+
+		BenchChannel *channel; //!< The channel the radio transmits on.
+		cQueue txBuffer; //!< Frames from the MAC waiting to be transmitted.
+		cMessage *txEndMsg; //!< Self-message marking the end of the frame being transmitted.
+		cMessage *rxEndMsg; //!< Self-message marking the end of the frame being received.
+		cMessage *rxFrame; //!< The frame being received; NULL if none.
+		bool rxCorrupt; //!< Indicate whether the frame being received has been corrupted.
+		bool sleepAfterTx; //!< Indicate whether the MAC asked the radio to sleep while transmitting.
+		double csValidTime; //!< The time from which the carrier sense is valid.
+		double busyUntil; //!< The time at which the last frame in range ends.
+		double senseEnd; //!< The end of the carrier sense strobe in progress; 0 if none.
+
+		long framesTransmitted; //!< Number of frames transmitted.
+		long framesDelivered; //!< Number of frames received and delivered to the MAC.
+		long collisions; //!< Number of frames lost because they overlapped another frame.
+		long bufferDrops; //!< Number of frames from the MAC dropped because the radio buffer was full.
+
+		void setState(int newState);
+		void startNextTx();
+		void endReception();
+		void notifyMac(int kind);
+
+	protected:
+		virtual void initialize();
+		virtual void handleMessage(cMessage *msg);
+		virtual void finish();
+
+	public:
+		RadioModule();
+		virtual ~RadioModule();
+
+		int isCarrierSenseValid();
+		void signalStart(cMessage *frame, double duration);
+};
+
+#endif
@@ -0,0 +1,22 @@
+/*!
+	\file ResourceGenericManager.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Implements the stub resource manager used by the SpeckMAC-D benchmark.
+*/
+
+#include "ResourceGenericManager.h"
+
+Define_Module(ResourceGenericManager);
+
+/*!
+	\brief Draw the clock drift of the node; the cpuClockDrift parameter is the relative drift (e.g. uniform(-0.00003, 0.00003)).
+*/
+void ResourceGenericManager::initialize()
+{
+	cpuClockDrift = 1.0 + (double) par("cpuClockDrift");
+}
+
+void ResourceGenericManager::handleMessage(cMessage *msg)
+{
+	delete msg;
+}
@@ -0,0 +1,31 @@
+/*!
+	\file ResourceGenericManager.h
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Definition of the stub resource manager used by the SpeckMAC-D benchmark in place of Castalia's ResourceGenericManager.
+*/
+
+#ifndef RESOURCEGENERICMANAGER
+#define RESOURCEGENERICMANAGER
+
+#include <omnetpp.h>
+
+/*!
+ \class ResourceGenericManager
+ \author Siddhu Warrier, University of Edinburgh
+ \brief Provides the CPU clock drift of the node; energy is not modelled, so no energy is ever spent.
+*/
+class ResourceGenericManager : public cSimpleModule
+{
+	private:
+		double cpuClockDrift; //!< The clock drift factor of the node.
+
+	protected:
+		virtual void initialize();
+		virtual void handleMessage(cMessage *msg);
+
+	public:
+		double getCPUClockDrift() {return cpuClockDrift;}
+		double getSpentEnergy() {return 0.0;}
+};
+
+#endif
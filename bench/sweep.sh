@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Run the SpeckMAC-D benchmark over a range of node counts, sleep intervals and
+# payload sizes. The redundancy of a train follows from the sleep interval and
+# the frame length, so both are swept. One BENCH line is printed per run, and
+# collected in sweep-results.txt.
+#
+# Usage: ./sweep.sh [simulated seconds]
+#
+
+SIM_TIME=${1:-20}
+NODES="10 100 1000 10000"
+SLEEP_INTERVALS="0.05 0.1 0.4"
+PAYLOADS="10 50 100"
+
+cd "$(dirname "$0")" || exit 1
+: > sweep-results.txt
+
+for nodes in $NODES; do
+	for sleep in $SLEEP_INTERVALS; do
+		for payload in $PAYLOADS; do
+			ini=sweep-$nodes-$sleep-$payload.ini
+			# The first matching entry wins, so the overrides come before omnetpp.ini.
+			cat > $ini <<EOI
+[General]
+sim-time-limit = $SIM_TIME
+output-scalar-file = sweep-$nodes-$sleep-$payload.sca
+output-vector-file = sweep-$nodes-$sleep-$payload.vec
+
+[Parameters]
+SpeckMacBench.numNodes = $nodes
+**.macModule.sleepInterval = $sleep
+**.networkModule.payloadSize = $payload
+
+include omnetpp.ini
+EOI
+			result=$(./SpeckMacBench -f $ini | grep '^BENCH')
+			echo "sleepInterval=$sleep payload=$payload $result" | tee -a sweep-results.txt
+		done
+	done
+done
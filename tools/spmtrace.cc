@@ -0,0 +1,125 @@
+/*!
+	\file spmtrace.cc
+	\author Siddhu Warrier, University of Edinburgh
+	\brief Reader of the binary trace of SpeckMAC-D state transitions (see BinaryTrace.h and the traceFile parameter of SpeckMacModule).
+
+	Usage: spmtrace [-n node] [-s] file...
+
+	The files of a rotated trace are given in order (trace.0 trace.1 ...). A parallel simulation writes the files of each partition apart (trace.p0.0 trace.p0.1 ... trace.p1.0 ...); the files of a partition are given in order, and the records of the partitions are not merged by time. By default, each record is printed as a CSV line:
+	time,event number,node,from state,to state,MAC event,buffer size
+	The states and the MAC event are the values of MacStates and MacEvents. -n keeps the records of a single node; -s prints the number of occurrences of each (from state, to state, MAC event) instead.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include "BinaryTrace.h"
+
+static const size_t readRecords = 32768; //!< Number of records read at once.
+
+/*!
+	\brief A (from state, to state, MAC event) triple, counted by -s.
+*/
+struct TransitionKey
+{
+	int fromState;
+	int toState;
+	int event;
+
+	bool operator<(const TransitionKey &other) const
+	{
+		if (fromState != other.fromState)
+			return fromState < other.fromState;
+		if (toState != other.toState)
+			return toState < other.toState;
+		return event < other.event;
+	}
+};
+
+static void usage()
+{
+	fprintf(stderr, "Usage: spmtrace [-n node] [-s] file...\n");
+	exit(2);
+}
+
+/*!
+	\brief Read the records of \b path, printing them or counting them in \b counts.
+	\return false if the file cannot be read, or is not a trace file.
+*/
+static bool readTrace(const char *path, int node, std::map<TransitionKey, long> *counts)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		perror(path);
+		return false;
+	}
+
+	BinaryTraceHeader header;
+	if ( (fread(&header, sizeof(header), 1, file) != 1) || (memcmp(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic)) != 0) || (header.recordSize != sizeof(TraceRecord)) )
+	{
+		fprintf(stderr, "%s: not a SpeckMAC-D binary trace of this version\n", path);
+		fclose(file);
+		return false;
+	}
+
+	static TraceRecord records[readRecords];
+	size_t numRecords;
+	while ( (numRecords = fread(records, sizeof(TraceRecord), readRecords, file)) > 0 )
+	{
+		for (size_t i = 0; i < numRecords; i++)
+		{
+			const TraceRecord &r = records[i];
+			if ( (r.recordType != TRACE_RECORD_TRANSITION) || ((node >= 0) && (r.node != node)) )
+				continue; // space left unfilled by a simulation that did not finish, or another node.
+
+			if (counts != NULL)
+			{
+				TransitionKey key = {r.fromState, r.toState, r.event};
+				(*counts)[key]++;
+			}
+			else
+				printf("%.9f,%lld,%d,%d,%d,%d,%d\n", r.time, (long long) r.eventNumber, (int) r.node, r.fromState, r.toState, r.event, (int) r.bufferSize);
+		}
+	}
+
+	bool ok = !ferror(file);
+	if (!ok)
+		perror(path);
+	fclose(file);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int node = -1;
+	bool summary = false;
+	int arg = 1;
+
+	for (; (arg < argc) && (argv[arg][0] == '-'); arg++)
+	{
+		if (strcmp(argv[arg], "-s") == 0)
+			summary = true;
+		else if ( (strcmp(argv[arg], "-n") == 0) && (arg + 1 < argc) )
+			node = atoi(argv[++arg]);
+		else
+			usage();
+	}
+	if (arg == argc)
+		usage();
+
+	std::map<TransitionKey, long> counts;
+	bool ok = true;
+	for (; arg < argc; arg++)
+		ok = readTrace(argv[arg], node, summary ? &counts : NULL) && ok;
+
+	if (summary)
+	{
+		printf("from state,to state,MAC event,count\n");
+		for (std::map<TransitionKey, long>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+			printf("%d,%d,%d,%ld\n", it->first.fromState, it->first.toState, it->first.event, it->second);
+	}
+
+	return ok ? 0 : 1;
+}